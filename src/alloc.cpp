@@ -0,0 +1,72 @@
+#include "alloc.h"
+
+#ifdef TRACK_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+    thread_local uint64_t Allocations = 0;
+
+    void* allocate(std::size_t size) {
+        ++Allocations;
+        if (void* p = std::malloc(size ? size : 1)) {
+            return p;
+        }
+        throw std::bad_alloc();
+    }
+}
+
+void* operator new(std::size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size) {
+    return allocate(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    ++Allocations;
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    ++Allocations;
+    return std::malloc(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+namespace Alloc {
+
+uint64_t count() {
+    return Allocations;
+}
+
+} // namespace Alloc
+
+#else
+
+namespace Alloc {
+
+uint64_t count() {
+    return 0;
+}
+
+} // namespace Alloc
+
+#endif
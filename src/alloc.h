@@ -0,0 +1,36 @@
+#ifndef ALLOC_H_INCLUDED
+#define ALLOC_H_INCLUDED
+
+#include <cstdint>
+
+// Counts heap allocations, to check that hot paths stay off the allocator.
+// Counting replaces the global operator new, so it is only compiled in with
+// -DTRACK_ALLOCATIONS; otherwise every count is zero.
+namespace Alloc {
+
+#ifdef TRACK_ALLOCATIONS
+constexpr bool Tracking = true;
+#else
+constexpr bool Tracking = false;
+#endif
+
+/// Allocations made through operator new by the calling thread so far.
+uint64_t count();
+
+// Counts the allocations made by the calling thread during its lifetime:
+//
+//   Alloc::Scope allocs;
+//   pos.new_timeline(l, t, undo);
+//   assert(allocs.count() == 0);
+class Scope {
+public:
+    Scope() : start(Alloc::count()) {}
+    uint64_t count() const { return Alloc::count() - start; }
+
+private:
+    uint64_t start;
+};
+
+} // namespace Alloc
+
+#endif
@@ -0,0 +1,931 @@
+// Benchmarks for the board and position primitives. This is its own
+// executable, built by 'make bench' (see the Makefile).
+//
+// Usage: bench [--perf] [--trace file] [runs]
+//        bench [--perf] [--trace file] signature [depth]
+//        bench [--trace file] threads [maxThreads] [depth]
+//        bench [--perf] [--trace file] multiverse [maxTimelines] [maxTurns]
+//        bench [--trace file] latency [requests]
+//        bench [--perf] table [megabytes]
+//
+// The first form runs microbenchmarks. Each one runs a few warmup batches,
+// then 'runs' timed batches, and reports the spread of ns/op over the timed
+// batches.
+//
+// The second walks a fixed suite of positions to a fixed depth and prints
+// the total node count, which only changes if the behaviour of Position
+// does, along with the nodes per second. Use it to check that a build is
+// both correct and fast.
+//
+// The third runs the signature walk and a batch of position generation
+// jobs on 1, 2, 4 ... maxThreads threads (all of the hardware's by default)
+// and reports how the time to finish, and to reach each depth of the walk,
+// scales.
+//
+// The fourth generates multiverses of 10, 50, 200 and 1000 timelines and
+// 8, 16 and 32 turns, up to the given limits, and reports how the cost of
+// the operations whose work grows with the multiverse scales with it.
+//
+// The fifth times each of 'requests' engine-sized operations on positions
+// of varying size separately, and prints the latency percentiles of each
+// kind (see histogram.h), since averages hide the tail.
+//
+// The sixth probes a table of the given size at random, as a transposition
+// table would be, once allocated with malloc and once with
+// aligned_large_pages_alloc (see misc.h), to show what large pages save.
+//
+// --perf reads the hardware counters (see perf.h) over each benchmark, or
+// each position of the signature walk, and prints them per phase at the end.
+//
+// Built with -DTRACK_ALLOCATIONS ('make bench-alloc', see alloc.h), the
+// first two forms also report heap allocations, and the microbenchmarks of
+// paths which must not allocate fail the run if they do. So does the
+// signature walk if branching and undoing in place on a warm position
+// allocates; the rest of the walk allocates by design, since it clones for
+// every append_board (see check_root_branch_allocs). 'make check' runs both.
+//
+// --trace writes a Chrome trace (see trace.h) of the benchmarks and their
+// batches, or of the signature positions.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "alloc.h"
+#include "histogram.h"
+#include "perf.h"
+#include "misc.h"
+#include "position.h"
+#include "randompos.h"
+#include "trace.h"
+#include "types.h"
+
+namespace {
+    const std::vector<std::string> Fens = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w",
+        "r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP3PPP/R2QKB1R b",
+        "3k/4/4/KN2 w",
+        "nbrk/pppp/PPPP/RKBN b",
+    };
+
+    constexpr int WarmupRuns = 3;
+
+    struct Stats {
+        const char* name;
+        double min, median, mean, stddev;
+        // over the timed batches
+        Perf::Counts counts;
+        double allocsPerOp;
+    };
+
+    // defeats dead code elimination of the benchmarked calls. Only the main
+    // thread may write it.
+    volatile size_t Sink;
+
+    // null unless --perf was given
+    Perf::Counters* PerfCounters = nullptr;
+    Perf::PhaseTable PerfPhases;
+
+    // benchmarks which allocated although they must not
+    int AllocFailures = 0;
+
+    // Times 'runs' batches of 'batch' calls to op(i), after a few untimed
+    // batches, giving ns per call for each timed batch. setup() runs before
+    // every batch and isn't timed.
+    template<typename Setup, typename Op>
+    Stats measure(const char* name, int runs, int batch, Setup setup, Op op) {
+        TRACE_SCOPE(name);
+
+        std::vector<double> nsPerOp;
+        Stats s;
+        s.name = name;
+        uint64_t allocs = 0;
+
+        for (int run = 0; run < WarmupRuns + runs; ++run) {
+            TRACE_SCOPE(run < WarmupRuns ? "warmup batch" : "batch");
+            setup();
+
+            // the counters are started outside the clock, so the ioctls
+            // don't show up in ns/op
+            const bool counted = PerfCounters && run >= WarmupRuns;
+            if (counted) {
+                PerfCounters->start();
+            }
+
+            Alloc::Scope batchAllocs;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < batch; ++i) {
+                op(i);
+            }
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            if (run >= WarmupRuns) {
+                allocs += batchAllocs.count();
+            }
+
+            if (counted) {
+                s.counts += PerfCounters->stop();
+            }
+            if (run >= WarmupRuns) {
+                nsPerOp.push_back(std::chrono::duration<double, std::nano>(elapsed).count() / batch);
+            }
+        }
+
+        std::sort(nsPerOp.begin(), nsPerOp.end());
+
+        s.allocsPerOp = double(allocs) / ((double)runs * batch);
+        s.min = nsPerOp.front();
+        s.median = nsPerOp[nsPerOp.size() / 2];
+        s.mean = 0;
+        for (double ns : nsPerOp) {
+            s.mean += ns;
+        }
+        s.mean /= nsPerOp.size();
+        s.stddev = 0;
+        for (double ns : nsPerOp) {
+            s.stddev += (ns - s.mean) * (ns - s.mean);
+        }
+        s.stddev = std::sqrt(s.stddev / nsPerOp.size());
+
+        return s;
+    }
+
+    template<typename Op>
+    Stats measure(const char* name, int runs, int batch, Op op) {
+        return measure(name, runs, batch, [] { }, op);
+    }
+
+    // allocFree benchmarks are of paths which must not allocate, once warm
+    void report(const Stats& s, bool allocFree = false) {
+        std::printf("%-28s %12.1f %12.1f %12.1f %10.1f",
+                    s.name, s.min, s.median, s.mean, s.stddev);
+        if (Alloc::Tracking) {
+            std::printf(" %10.3f", s.allocsPerOp);
+        }
+        std::printf("\n");
+
+        if (Alloc::Tracking && allocFree && s.allocsPerOp > 0) {
+            std::fprintf(stderr, "%s: %.3f allocations per call, expected none\n",
+                         s.name, s.allocsPerOp);
+            ++AllocFailures;
+        }
+        if (PerfCounters) {
+            PerfPhases.add(s.name, s.counts);
+        }
+    }
+
+    // a few timelines deep enough to branch from, for new_timeline
+    RandomPositionParams multiverse_params() {
+        RandomPositionParams params;
+        params.timelines = 5;
+        params.turns = 10;
+        params.density = 30;
+        return params;
+    }
+
+    // The positions walked by 'bench signature': a single board, a few
+    // timelines and many timelines.
+    void setup_signature_position(Position& pos, int idx) {
+        RandomPositionParams params;
+
+        switch (idx) {
+        case 0:
+            pos.set({ }, { Fens[0] });
+            return;
+        case 1:
+            pos.set({ Fens[2] }, { Fens[1], Fens[3] });
+            return;
+        case 2:
+            params.timelines = 3;
+            params.turns = 4;
+            params.boardWidth = 5;
+            params.seed = 2020;
+            break;
+        default:
+            params.timelines = 12;
+            params.turns = 3;
+            params.seed = 5;
+            break;
+        }
+
+        random_position(pos, params);
+    }
+
+    constexpr int SignaturePositions = 4;
+
+    // There is no move generation yet, so the walk plays the moves which
+    // Position itself knows about: each playable board either moves on its
+    // own timeline (append_board, on a clone) or branches to each earlier
+    // board on its timeline with the same side to move (new_timeline, undone
+    // afterwards). Both end the turn. Pieces don't move, but timeline
+    // activation, the playable lists and the present all decide the shape of
+    // the tree, so the node count changes if any of them does.
+    //
+    // With allocation tracking, the branches taken on CheckedRoot and their
+    // undos count their allocations into RootBranchAllocs.
+    const Position* CheckedRoot = nullptr;
+    uint64_t RootBranchAllocs = 0;
+
+    uint64_t walk(Position& pos, int depth) {
+        if (depth == 0) {
+            return 1;
+        }
+
+        uint64_t nodes = 1;
+        const Color us = pos.side_to_move();
+        const std::vector<L> playable = pos.playable_timelines();
+
+        for (L line : playable) {
+            Position child = pos.clone();
+            child.append_board(line);
+            child.pass_turn();
+            nodes += walk(child, depth - 1);
+
+            const Timeline& tl = pos.timeline(line);
+            const Time endTime = tl.end_time();
+            for (Time t = tl.start_time() + (us < tl.start_color()); t < endTime; ++t) {
+                // the allocations of the subtree don't count
+                const bool checked = Alloc::Tracking && &pos == CheckedRoot;
+                uint64_t allocs = checked ? Alloc::count() : 0;
+
+                NewTimelineUndo undo;
+                pos.new_timeline(line, t, undo);
+                pos.pass_turn();
+                allocs = checked ? Alloc::count() - allocs : 0;
+
+                nodes += walk(pos, depth - 1);
+
+                const uint64_t undoStart = checked ? Alloc::count() : 0;
+                pos.pass_turn();
+                pos.undo_new_timeline(undo);
+                if (checked) {
+                    RootBranchAllocs += allocs + Alloc::count() - undoStart;
+                }
+            }
+        }
+
+        return nodes;
+    }
+
+    // Most of the walk's allocations are inherent to it: every append_board
+    // is made on a fresh clone, which copies the timeline list and gets its
+    // own pages, and the first branches on a clone allocate its spare pages
+    // and grow its lists. A search branches and undoes in place on a
+    // position of its own instead, which must not allocate once warm. So
+    // walk each position a second time and require that the branches taken
+    // on the root itself, nested as deep as the walk goes, don't allocate.
+    void check_root_branch_allocs(int depth) {
+        for (int idx = 0; idx < SignaturePositions; ++idx) {
+            Position pos;
+            setup_signature_position(pos, idx);
+            walk(pos, depth);
+
+            CheckedRoot = &pos;
+            RootBranchAllocs = 0;
+            walk(pos, depth);
+            CheckedRoot = nullptr;
+
+            if (RootBranchAllocs) {
+                std::fprintf(stderr, "signature %d: %llu allocations branching on the root, "
+                             "expected none\n", idx + 1, (unsigned long long)RootBranchAllocs);
+                ++AllocFailures;
+            }
+        }
+    }
+
+    int run_signature(int depth) {
+        uint64_t nodes = 0;
+        Alloc::Scope allocs;
+        auto start = std::chrono::steady_clock::now();
+
+        for (int idx = 0; idx < SignaturePositions; ++idx) {
+            TRACE_SCOPE("signature position");
+
+            Position pos;
+            setup_signature_position(pos, idx);
+
+            uint64_t posNodes;
+            {
+                TRACE_SCOPE("walk");
+                Perf::Scope scope(PerfCounters, PerfPhases, "signature " + std::to_string(idx + 1));
+                posNodes = walk(pos, depth);
+            }
+            std::printf("Position: %d/%d (%d lines)  nodes %llu\n",
+                        idx + 1, SignaturePositions,
+                        pos.negative_timeline_count() + pos.positive_timeline_count() + 1,
+                        (unsigned long long)posNodes);
+            nodes += posNodes;
+        }
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::printf("\n===========================\n");
+        std::printf("Total time (ms) : %.0f\n", elapsed * 1000);
+        std::printf("Nodes searched  : %llu\n", (unsigned long long)nodes);
+        std::printf("Nodes/second    : %.0f\n", nodes / std::max(elapsed, 1e-9));
+        if (Alloc::Tracking) {
+            std::printf("Allocs/node     : %.3f\n", double(allocs.count()) / nodes);
+            check_root_branch_allocs(depth);
+        }
+        return 0;
+    }
+
+    // A move at the root of the signature walk, so that the walk can be split
+    // between threads.
+    struct RootMove {
+        int position;
+        L line;
+        // new_timeline(line, time) rather than append_board(line)
+        bool branch;
+        Time time;
+    };
+
+    // in the order walk() plays them
+    void add_root_moves(const Position& pos, int idx, std::vector<RootMove>& moves) {
+        const Color us = pos.side_to_move();
+
+        for (L line : pos.playable_timelines()) {
+            moves.push_back({ idx, line, false, 0 });
+
+            const Timeline& tl = pos.timeline(line);
+            for (Time t = tl.start_time() + (us < tl.start_color()); t < tl.end_time(); ++t) {
+                moves.push_back({ idx, line, true, t });
+            }
+        }
+    }
+
+    uint64_t walk(const Position& root, const RootMove& move, int depth) {
+        Position pos = root.clone();
+        if (move.branch) {
+            pos.new_timeline(move.line, move.time);
+        } else {
+            pos.append_board(move.line);
+        }
+        pos.pass_turn();
+        return walk(pos, depth - 1);
+    }
+
+    // 'threads' threads to run batches of jobs on: the caller and threads - 1
+    // helpers. The helpers are started with the pool and wait between
+    // batches, so that the time of a batch doesn't include starting threads.
+    class WorkerPool {
+    public:
+        explicit WorkerPool(int threads);
+        ~WorkerPool();
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        // Runs job(i) for i in [0, jobs) on the pool's threads, which take the
+        // next job as they finish their last, and returns the wall time in
+        // seconds.
+        double run(size_t jobs, const std::function<void(size_t)>& job);
+
+    private:
+        void help();
+        void take_jobs();
+
+        std::vector<std::thread> helpers;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable finished;
+
+        // the current batch; set under mutex while no helper is busy
+        const std::function<void(size_t)>* job = nullptr;
+        size_t jobs = 0;
+        std::atomic<size_t> next{0};
+        // counts batches, so that helpers can tell a new one from the last
+        uint64_t batch = 0;
+        int busy = 0;
+        bool quitting = false;
+    };
+
+    WorkerPool::WorkerPool(int threads) {
+        for (int t = 1; t < threads; ++t) {
+            helpers.emplace_back(&WorkerPool::help, this);
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quitting = true;
+        }
+        wake.notify_all();
+        for (std::thread& h : helpers) {
+            h.join();
+        }
+    }
+
+    double WorkerPool::run(size_t setJobs, const std::function<void(size_t)>& setJob) {
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &setJob;
+            jobs = setJobs;
+            next = 0;
+            ++batch;
+            busy = helpers.size();
+        }
+        wake.notify_all();
+
+        take_jobs();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return busy == 0; });
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void WorkerPool::help() {
+        Trace::set_thread_name("worker");
+        uint64_t lastBatch = 0;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [&] { return quitting || batch != lastBatch; });
+            if (quitting) {
+                return;
+            }
+            lastBatch = batch;
+
+            lock.unlock();
+            take_jobs();
+            lock.lock();
+
+            if (--busy == 0) {
+                finished.notify_one();
+            }
+        }
+    }
+
+    void WorkerPool::take_jobs() {
+        for (size_t i; (i = next.fetch_add(1)) < jobs; ) {
+            (*job)(i);
+        }
+    }
+
+    constexpr int ScalingRuns = 3;
+
+    void print_scaling(int threads, double seconds, double baseSeconds) {
+        const double speedup = baseSeconds / seconds;
+        std::printf("%7d %12.1f %9.2f %10.1f%%", threads, seconds * 1000,
+                    speedup, 100 * speedup / threads);
+    }
+
+    int run_threads(int maxThreads, int depth) {
+        std::vector<int> threadCounts;
+        for (int t = 1; t < maxThreads; t *= 2) {
+            threadCounts.push_back(t);
+        }
+        threadCounts.push_back(maxThreads);
+
+        std::vector<Position> roots(SignaturePositions);
+        std::vector<RootMove> moves;
+        for (int idx = 0; idx < SignaturePositions; ++idx) {
+            setup_signature_position(roots[idx], idx);
+            add_root_moves(roots[idx], idx, moves);
+        }
+
+        // Time to depth: the walk to each depth in turn, as iterative
+        // deepening would, timing each thread count at its best of a few runs.
+        std::printf("Signature walk, %zu root moves\n", moves.size());
+        std::printf("%7s %12s %9s %11s   time to depth (ms)\n",
+                    "threads", "time (ms)", "speedup", "efficiency");
+
+        uint64_t expectedNodes = 0;
+        double baseSeconds = 0;
+        for (int threads : threadCounts) {
+            WorkerPool pool(threads);
+            std::vector<double> toDepth(depth + 1, 0);
+
+            for (int run = 0; run < ScalingRuns; ++run) {
+                double elapsed = 0;
+                for (int d = 1; d <= depth; ++d) {
+                    std::atomic<uint64_t> nodes(SignaturePositions);
+                    elapsed += pool.run(moves.size(), [&](size_t i) {
+                        TRACE_SCOPE("root move");
+                        nodes += walk(roots[moves[i].position], moves[i], d);
+                    });
+                    if (run == 0 || elapsed < toDepth[d]) {
+                        toDepth[d] = elapsed;
+                    }
+
+                    if (d == depth && !expectedNodes) {
+                        expectedNodes = nodes;
+                    } else if (d == depth && nodes != expectedNodes) {
+                        std::fprintf(stderr, "%d threads: %llu nodes, expected %llu\n", threads,
+                                     (unsigned long long)nodes, (unsigned long long)expectedNodes);
+                        return 1;
+                    }
+                }
+            }
+
+            if (threads == 1) {
+                baseSeconds = toDepth[depth];
+            }
+            print_scaling(threads, toDepth[depth], baseSeconds);
+            std::printf("  ");
+            for (int d = 1; d <= depth; ++d) {
+                std::printf(" %.1f", toDepth[d] * 1000);
+            }
+            std::printf("\n");
+        }
+        std::printf("Nodes searched: %llu\n", (unsigned long long)expectedNodes);
+
+        // A batch of independent jobs, which scale unless the allocator or
+        // shared cache lines get in the way.
+        constexpr size_t BatchJobs = 64;
+        std::printf("\nBatch of %zu random positions with memory_usage()\n", BatchJobs);
+        std::printf("%7s %12s %9s %11s\n", "threads", "time (ms)", "speedup", "efficiency");
+
+        for (int threads : threadCounts) {
+            WorkerPool pool(threads);
+            double best = 0;
+            for (int run = 0; run < ScalingRuns; ++run) {
+                // a sink per job, since Sink itself isn't safe to share
+                std::vector<size_t> sinks(BatchJobs);
+                double elapsed = pool.run(BatchJobs, [&](size_t i) {
+                    TRACE_SCOPE("batch job");
+                    RandomPositionParams params = multiverse_params();
+                    params.seed = 1 + i;
+                    Position pos;
+                    random_position(pos, params);
+                    sinks[i] = pos.memory_usage().live();
+                });
+                for (size_t sink : sinks) {
+                    Sink = Sink + sink;
+                }
+                if (run == 0 || elapsed < best) {
+                    best = elapsed;
+                }
+            }
+
+            if (threads == 1) {
+                baseSeconds = best;
+            }
+            print_scaling(threads, best, baseSeconds);
+            std::printf("\n");
+        }
+
+        return 0;
+    }
+
+    constexpr int MultiverseRuns = 5;
+
+    int run_multiverse(int maxTimelines, int maxTurns) {
+        const int TimelineCounts[] = { 10, 50, 200, 1000 };
+        const int TurnCounts[] = { 8, 16, 32 };
+
+        // There is no move generation or check detection yet. In their place,
+        // 'moves' lists the moves the signature walk plays from the position,
+        // and 'scan' reads every square of every playable board, which both
+        // of them will have to do at least.
+        std::printf("%6s %6s %8s %10s %10s %10s %10s %10s %12s %10s\n",
+                    "lines", "turns", "boards", "gen ms", "moves us", "scan us",
+                    "clone us", "memory MB", "mem_usage us", "render ms");
+
+        for (int timelines : TimelineCounts) {
+            if (timelines > maxTimelines) {
+                break;
+            }
+            for (int turns : TurnCounts) {
+                if (turns > maxTurns) {
+                    break;
+                }
+
+                RandomPositionParams params;
+                params.timelines = timelines;
+                params.turns = turns;
+                params.seed = 98 * timelines + turns;
+
+                Position pos;
+                auto start = std::chrono::steady_clock::now();
+                random_position(pos, params);
+                double genSeconds = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start).count();
+
+                int lines = 0, boards = 0;
+                for (L l = -pos.negative_timeline_count(); l <= pos.positive_timeline_count(); ++l) {
+                    const Timeline& tl = pos.timeline(l);
+                    ++lines;
+                    // one board per ply, from the first to the last
+                    boards += 2 * (tl.end_time() - tl.start_time()) + 1
+                            + int(tl.last_board().side_to_move()) - int(tl.start_color());
+                }
+
+                std::vector<RootMove> moves;
+                Stats movesStats = measure("multiverse moves", MultiverseRuns, 10, [&](int) {
+                    moves.clear();
+                    add_root_moves(pos, 0, moves);
+                    Sink = moves.size();
+                });
+
+                Stats scanStats = measure("multiverse scan", MultiverseRuns, 10, [&](int) {
+                    size_t occupied = 0;
+                    for (L line : pos.playable_timelines()) {
+                        const Board2D& b = pos.timeline(line).last_board();
+                        for (Square2D sq = SQ_A1; sq <= SQ_H8; ++sq) {
+                            occupied += !b.empty(sq);
+                        }
+                    }
+                    Sink = occupied;
+                });
+
+                Stats cloneStats = measure("multiverse clone", MultiverseRuns, 10, [&](int) {
+                    Position c = pos.clone();
+                    Sink = c.positive_timeline_count();
+                });
+
+                MemoryUsage usage;
+                Stats usageStats = measure("multiverse memory_usage", MultiverseRuns, 10, [&](int) {
+                    usage = pos.memory_usage();
+                    Sink = usage.live();
+                });
+
+                Stats renderStats = measure("multiverse render", MultiverseRuns, 1, [&](int) {
+                    std::ostringstream ss;
+                    ss << pos;
+                    Sink = ss.str().size();
+                });
+
+                std::printf("%6d %6d %8d %10.1f %10.1f %10.1f %10.1f %10.2f %12.1f %10.1f\n",
+                            lines, turns, boards, genSeconds * 1000,
+                            movesStats.median / 1000, scanStats.median / 1000,
+                            cloneStats.median / 1000, usage.live() / (1024.0 * 1024.0),
+                            usageStats.median / 1000, renderStats.median / 1e6);
+
+                if (PerfCounters) {
+                    const std::string size = " " + std::to_string(lines) + "x" + std::to_string(turns);
+                    for (const Stats* st : { &movesStats, &scanStats, &cloneStats, &usageStats, &renderStats }) {
+                        PerfPhases.add(st->name + size, st->counts);
+                    }
+                }
+            }
+        }
+
+        return 0;
+    }
+
+    // Positions from a single board to a few hundred timelines, so that the
+    // latencies have the spread they would over a session with many users.
+    constexpr int LatencyPositions = 16;
+
+    RandomPositionParams latency_params(int idx) {
+        RandomPositionParams params;
+        params.timelines = 1 + (idx * idx * 3) % 200;
+        params.turns = 3 + idx % 6;
+        params.seed = 99 + idx;
+        return params;
+    }
+
+    int run_latency(int requests) {
+        std::vector<Position> positions(LatencyPositions);
+        std::vector<std::vector<std::string>> fens(LatencyPositions);
+        for (int idx = 0; idx < LatencyPositions; ++idx) {
+            random_position(positions[idx], latency_params(idx));
+            for (L l = 0; l <= positions[idx].positive_timeline_count(); ++l) {
+                fens[idx].push_back(positions[idx].timeline(l).last_board().fen());
+            }
+        }
+
+        // There is no protocol or search yet. The requests are what a
+        // protocol would do today: set up a position from FENs, list the
+        // moves, search a shallow tree of them, and print the position.
+        struct Request {
+            const char* name;
+            std::function<void(int)> run;
+            Histogram latency;
+        };
+        std::vector<std::string> noFens;
+        Request kinds[] = {
+            { "position setup", [&](int idx) {
+                Position pos;
+                pos.set(noFens, fens[idx]);
+                Sink = pos.positive_timeline_count();
+            }, Histogram() },
+            { "moves", [&](int idx) {
+                std::vector<RootMove> moves;
+                add_root_moves(positions[idx], idx, moves);
+                Sink = moves.size();
+            }, Histogram() },
+            { "walk depth 2", [&](int idx) {
+                Position pos = positions[idx].clone();
+                Sink = walk(pos, 2);
+            }, Histogram() },
+            { "render", [&](int idx) {
+                std::ostringstream ss;
+                ss << positions[idx];
+                Sink = ss.str().size();
+            }, Histogram() },
+        };
+
+        PRNG rng(4099);
+        for (int i = 0; i < requests; ++i) {
+            Request& req = kinds[rng.rand_below(4)];
+            const int idx = rng.rand_below(LatencyPositions);
+
+            TRACE_SCOPE(req.name);
+            auto start = std::chrono::steady_clock::now();
+            req.run(idx);
+            req.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+
+        std::printf("%-16s %8s %10s %10s %10s %10s %10s %10s\n", "latency us",
+                    "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+        for (const Request& req : kinds) {
+            const Histogram& h = req.latency;
+            std::printf("%-16s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                        req.name, (unsigned long long)h.count(), h.mean() / 1000,
+                        h.percentile(50) / 1000.0, h.percentile(90) / 1000.0,
+                        h.percentile(99) / 1000.0, h.percentile(99.9) / 1000.0,
+                        h.max() / 1000.0);
+        }
+
+        return 0;
+    }
+
+    int run_table(int megabytes) {
+        // a power of two of entries, like a hash table
+        size_t entries = 1;
+        while (entries * 2 * sizeof(uint64_t) <= size_t(megabytes) << 20) {
+            entries *= 2;
+        }
+        const size_t bytes = entries * sizeof(uint64_t);
+
+        uint64_t* plain = static_cast<uint64_t*>(std::malloc(bytes));
+        uint64_t* large = static_cast<uint64_t*>(aligned_large_pages_alloc(bytes));
+        if (!plain || !large) {
+            std::fprintf(stderr, "Can't allocate %zu MB twice\n", bytes >> 20);
+            std::free(plain);
+            aligned_large_pages_free(large);
+            return 1;
+        }
+        // touch every page, so that the probes don't fault them in
+        for (size_t i = 0; i < entries; ++i) {
+            plain[i] = large[i] = i;
+        }
+
+        std::printf("%-28s %12s %12s %12s %10s\n",
+                    "ns/op", "min", "median", "mean", "stddev");
+        for (uint64_t* table : { plain, large }) {
+            PRNG rng(1070372);
+            report(measure(table == plain ? "probe (malloc)" : "probe (large pages)",
+                           15, 1000000, [&](int) {
+                Sink = table[rng.rand<uint64_t>() & (entries - 1)];
+            }));
+        }
+
+        std::free(plain);
+        aligned_large_pages_free(large);
+        return 0;
+    }
+
+    int run_micro(int runs) {
+        std::printf("%-28s %12s %12s %12s %10s",
+                    "ns/op", "min", "median", "mean", "stddev");
+        if (Alloc::Tracking) {
+            std::printf(" %10s", "allocs/op");
+        }
+        std::printf("\n");
+
+        Board2D board;
+        report(measure("Board2D::set", runs, 10000, [&](int i) {
+            board.set(Fens[i % Fens.size()]);
+            Sink = board.board_width();
+        }));
+
+        std::vector<Board2D> boards(Fens.size());
+        for (size_t i = 0; i < Fens.size(); ++i) {
+            boards[i].set(Fens[i]);
+        }
+        report(measure("Board2D::fen", runs, 10000, [&](int i) {
+            Sink = boards[i % boards.size()].fen().size();
+        }));
+
+        board.set(Fens[1]);
+        report(measure("put_piece+remove_piece", runs, 1000000, [&](int i) {
+            Square2D s = Square2D(SQ_A3 + i % 24);
+            if (board.empty(s)) {
+                board.put_piece(W_KNIGHT, s);
+                board.remove_piece(s);
+            } else {
+                Piece pc = board.piece_on(s);
+                board.remove_piece(s);
+                board.put_piece(pc, s);
+            }
+            Sink = board.piece_on(s);
+        }), true);
+
+        Position pos;
+        report(measure("Position::set (7 lines)", runs, 2000, [&](int) {
+            pos.set({ Fens[0], Fens[1], Fens[2] }, { Fens[3], Fens[0], Fens[1], Fens[2] });
+            Sink = pos.positive_timeline_count();
+        }));
+
+        Position multiverse;
+        random_position(multiverse, multiverse_params());
+        // every board of the central line which the side to move could branch from
+        std::vector<Time> branchTimes;
+        const Timeline& central = multiverse.timeline(0);
+        for (Time t = central.start_time(); t < central.end_time(); ++t) {
+            if (central.has_board_on_turn(t, multiverse.side_to_move())) {
+                branchTimes.push_back(t);
+            }
+        }
+        report(measure("new_timeline+undo", runs, 100000, [&](int i) {
+            NewTimelineUndo undo;
+            Board2D& b = multiverse.new_timeline(0, branchTimes[i % branchTimes.size()], undo);
+            Sink = b.side_to_move();
+            multiverse.undo_new_timeline(undo);
+        }), true);
+
+        report(measure("playable last_board scan", runs, 100000, [&](int) {
+            size_t n = 0;
+            for (L line : multiverse.playable_timelines()) {
+                n += multiverse.timeline(line).last_board().side_to_move();
+            }
+            Sink = n;
+        }), true);
+
+        report(measure("operator<<(Position)", runs, 50, [&](int) {
+            std::ostringstream ss;
+            ss << multiverse;
+            Sink = ss.str().size();
+        }));
+
+        return 0;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> args;
+    bool perf = false;
+    std::string tracePath;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--perf") {
+            perf = true;
+        } else if (std::string(argv[i]) == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+
+    Perf::Counters counters;
+    if (perf) {
+        if (counters.available()) {
+            PerfCounters = &counters;
+        } else {
+            std::fprintf(stderr, "Hardware counters are unavailable here, ignoring --perf\n");
+        }
+    }
+
+    if (!tracePath.empty()) {
+        if (Trace::start(tracePath)) {
+            Trace::set_thread_name("main");
+        } else {
+            std::fprintf(stderr, "Can't write a trace to %s\n", tracePath.c_str());
+        }
+    }
+
+    std::string command = args.size() > 0 ? args[0] : "";
+    int result;
+
+    if (command == "signature") {
+        result = run_signature(args.size() > 1 ? std::max(1, std::atoi(args[1].c_str())) : 6);
+    } else if (command == "table") {
+        result = run_table(args.size() > 1 ? std::max(1, std::atoi(args[1].c_str())) : 1024);
+    } else if (command == "latency") {
+        result = run_latency(args.size() > 1 ? std::max(1, std::atoi(args[1].c_str())) : 4000);
+    } else if (command == "multiverse") {
+        result = run_multiverse(args.size() > 1 ? std::atoi(args[1].c_str()) : 1000,
+                                args.size() > 2 ? std::atoi(args[2].c_str()) : 32);
+    } else if (command == "threads") {
+        int maxThreads = std::max(1, (int)std::thread::hardware_concurrency());
+        result = run_threads(args.size() > 1 ? std::max(1, std::atoi(args[1].c_str())) : maxThreads,
+                             args.size() > 2 ? std::max(1, std::atoi(args[2].c_str())) : 6);
+    } else {
+        result = run_micro(args.size() > 0 ? std::max(1, std::atoi(args[0].c_str())) : 15);
+    }
+
+    Trace::stop();
+
+    if (PerfCounters && !PerfPhases.empty()) {
+        std::ostringstream ss;
+        PerfPhases.print(ss);
+        std::printf("\n%s", ss.str().c_str());
+    }
+
+    return AllocFailures ? 1 : result;
+}
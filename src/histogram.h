@@ -0,0 +1,121 @@
+#ifndef HISTOGRAM_H_INCLUDED
+#define HISTOGRAM_H_INCLUDED
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// A histogram of latencies in the style of HdrHistogram: values below 2^7
+// are counted exactly, and every power of two above that is split into 64
+// equal buckets. Percentiles are then within 1/64 of the true value over the
+// whole range of uint64_t, in a fixed 30kB, and recording a value is a few
+// instructions, so tails can be measured without keeping every sample.
+class Histogram {
+public:
+    Histogram() : counts(BUCKETS, 0) {}
+
+    void record(uint64_t value);
+    /// Adds the values recorded by other, as if they had been recorded here.
+    void merge(const Histogram& other);
+    void reset();
+
+    uint64_t count() const { return total; }
+    uint64_t min() const { return total ? minValue : 0; }
+    uint64_t max() const { return maxValue; }
+    double mean() const { return total ? double(sum) / total : 0; }
+
+    /// The value which p percent of the recorded values are at or below,
+    /// to the precision of the buckets. 0 if nothing was recorded.
+    uint64_t percentile(double p) const;
+
+private:
+    static constexpr int SUB_BITS = 7;
+    static constexpr int HALF = 1 << (SUB_BITS - 1);
+    static constexpr int BUCKETS = (64 - SUB_BITS + 2) * HALF;
+
+    static int msb(uint64_t v);
+    static int bucket_of(uint64_t value);
+    // the largest value which falls in the bucket
+    static uint64_t bucket_max(int bucket);
+
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t minValue = std::numeric_limits<uint64_t>::max();
+    uint64_t maxValue = 0;
+    // may wrap for huge values, which only makes mean() wrong
+    uint64_t sum = 0;
+};
+
+inline int Histogram::msb(uint64_t v) {
+#if defined(__GNUC__)
+    return 63 ^ __builtin_clzll(v);
+#else
+    int b = 0;
+    while (v >>= 1) {
+        ++b;
+    }
+    return b;
+#endif
+}
+
+// Value v with its highest set bit at position m >= SUB_BITS is shifted
+// right by m - SUB_BITS + 1 to keep its top SUB_BITS bits, which lie in
+// [HALF, 2 * HALF). Each shift gets the HALF buckets after those of the
+// previous one; shift 0 covers [0, 2 * HALF) exactly.
+inline int Histogram::bucket_of(uint64_t value) {
+    const int shift = value < 2 * HALF ? 0 : msb(value) - SUB_BITS + 1;
+    return shift * HALF + int(value >> shift);
+}
+
+inline uint64_t Histogram::bucket_max(int bucket) {
+    const int shift = bucket < 2 * HALF ? 0 : bucket / HALF - 1;
+    const uint64_t top = bucket - shift * HALF;
+    // wraps to the maximum for the last bucket
+    return ((top + 1) << shift) - 1;
+}
+
+inline void Histogram::record(uint64_t value) {
+    ++counts[bucket_of(value)];
+    ++total;
+    sum += value;
+    minValue = std::min(minValue, value);
+    maxValue = std::max(maxValue, value);
+}
+
+inline void Histogram::merge(const Histogram& other) {
+    for (int i = 0; i < BUCKETS; ++i) {
+        counts[i] += other.counts[i];
+    }
+    total += other.total;
+    sum += other.sum;
+    minValue = std::min(minValue, other.minValue);
+    maxValue = std::max(maxValue, other.maxValue);
+}
+
+inline void Histogram::reset() {
+    std::fill(counts.begin(), counts.end(), 0);
+    total = 0;
+    sum = 0;
+    minValue = std::numeric_limits<uint64_t>::max();
+    maxValue = 0;
+}
+
+inline uint64_t Histogram::percentile(double p) const {
+    if (!total) {
+        return 0;
+    }
+
+    const uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(p / 100 * total));
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return std::min(std::max(bucket_max(i), minValue), maxValue);
+        }
+    }
+    return maxValue;
+}
+
+#endif
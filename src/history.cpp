@@ -0,0 +1,117 @@
+#include <cassert>
+
+#include "history.h"
+#include "position.h"
+#include "types.h"
+
+CompressedTimeline::CompressedTimeline(const Timeline& line, int setCheckpointInterval) {
+    assert(setCheckpointInterval > 0);
+
+    startTime = line.startTime;
+    startColor = line.startColor;
+    active = line.active;
+    checkpointInterval = setCheckpointInterval;
+    boardCount = line.boardCount;
+
+    // scratch boards for frozen boards of line
+    Board2D thawed[2];
+
+    for (int idx = 0; idx < boardCount; ++idx) {
+        const Board2D& board = line.full_board_at(idx, thawed[idx % 2]);
+
+        deltas.push_back({ uint32_t(changes.size()), board.side_to_move() });
+
+        if (idx % checkpointInterval == 0) {
+            checkpoints.push_back(line.is_frozen(idx) ? line.frozen_board_at(idx)
+                                                      : FrozenBoard2D(board));
+            continue;
+        }
+
+        const Board2D& prev = line.full_board_at(idx - 1, thawed[(idx - 1) % 2]);
+        for (Square2D s = SQ_A1; s <= SQ_H8; ++s) {
+            if (board.piece_on(s) != prev.piece_on(s)) {
+                changes.push_back({ uint8_t(s), uint8_t(board.piece_on(s)) });
+            }
+        }
+    }
+    deltas.push_back({ uint32_t(changes.size()), startColor });
+
+    checkpoints.shrink_to_fit();
+    deltas.shrink_to_fit();
+    changes.shrink_to_fit();
+}
+
+void CompressedTimeline::apply_delta(Board2D& board, int idx) const {
+    for (uint32_t i = deltas[idx].firstChange; i < deltas[idx + 1].firstChange; ++i) {
+        Square2D s = Square2D(changes[i].square);
+
+        if (!board.empty(s)) {
+            board.remove_piece(s);
+        }
+        if (changes[i].piece != NO_PIECE) {
+            board.put_piece(Piece(changes[i].piece), s);
+        }
+    }
+    board.sideToMove = deltas[idx].sideToMove;
+}
+
+const Board2D& CompressedTimeline::board_at(int idx) const {
+    assert(idx >= 0 && idx < boardCount);
+
+    const int checkpointIdx = idx - idx % checkpointInterval;
+
+    if (!materialized) {
+        materialized.reset(new Materialized[MATERIALIZED_BOARDS]);
+    }
+
+    // Find the slot to use: the board itself if it is cached, otherwise the
+    // least recently used slot. Remember the latest cached board we can
+    // build forward from.
+    Materialized* victim = &materialized[0];
+    const Materialized* base = nullptr;
+
+    for (int i = 0; i < MATERIALIZED_BOARDS; ++i) {
+        Materialized& m = materialized[i];
+        if (m.idx == idx) {
+            m.lastUse = ++useClock;
+            return m.board;
+        }
+        if (m.lastUse < victim->lastUse) {
+            victim = &m;
+        }
+        if (m.idx >= checkpointIdx && m.idx < idx && (!base || m.idx > base->idx)) {
+            base = &m;
+        }
+    }
+
+    int builtIdx;
+    if (base && base != victim) {
+        new (&victim->board) Board2D(base->board);
+        builtIdx = base->idx;
+    } else if (base) {
+        // we are about to overwrite the base, so build on it in place.
+        builtIdx = base->idx;
+    } else {
+        checkpoints[idx / checkpointInterval].thaw(victim->board);
+        builtIdx = checkpointIdx;
+    }
+
+    while (builtIdx < idx) {
+        apply_delta(victim->board, ++builtIdx);
+    }
+
+    victim->idx = idx;
+    victim->lastUse = ++useClock;
+    return victim->board;
+}
+
+Timeline CompressedTimeline::expand() const {
+    Timeline line(startTime, startColor);
+    line.active = active;
+
+    for (int idx = 0; idx < boardCount; ++idx) {
+        line.append_board(board_at(idx));
+    }
+
+    return line;
+}
@@ -0,0 +1,105 @@
+#ifndef HISTORY_H_INCLUDED
+#define HISTORY_H_INCLUDED
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "position.h"
+#include "types.h"
+
+// Consecutive boards on a timeline differ by a handful of squares, so
+// keeping every one of them in full is mostly redundant for long games.
+// A CompressedTimeline is a read-only copy of a timeline which stores a
+// frozen board (a checkpoint, see FrozenBoard2D) every checkpointInterval
+// boards and only the changed squares for the boards in between.
+//
+// Boards are rebuilt on demand into a small cache of recently used boards,
+// which is only allocated when the first board is read. Rebuilding starts
+// from the closest earlier cached board on the same checkpoint if there is
+// one, so walking a timeline in order costs one delta per board.
+class CompressedTimeline {
+public:
+    explicit CompressedTimeline(const Timeline& line, int checkpointInterval = 16);
+    CompressedTimeline(const CompressedTimeline&) = delete;
+    CompressedTimeline& operator=(const CompressedTimeline&) = delete;
+
+    Time start_time() const;
+    Color start_color() const;
+    bool is_active() const;
+    int board_count() const;
+
+    bool has_board_on_turn(Time time, Color c) const;
+    /// The reference is invalidated by requesting MATERIALIZED_BOARDS other
+    /// boards. Because of the cache, this is not safe to call concurrently.
+    const Board2D& board_on_turn(Time time, Color c) const;
+
+    /// Rebuilds an ordinary Timeline with every board in full.
+    Timeline expand() const;
+
+    static constexpr int MATERIALIZED_BOARDS = 4;
+private:
+    // A Square2D and a Piece both fit in a byte.
+    struct SquareChange {
+        uint8_t square;
+        uint8_t piece;
+    };
+
+    // The changes which turn board i-1 into board i are
+    // changes[deltas[i].firstChange] up to changes[deltas[i+1].firstChange].
+    struct Delta {
+        uint32_t firstChange;
+        Color sideToMove;
+    };
+
+    struct Materialized {
+        int idx = -1;
+        uint64_t lastUse = 0;
+        Board2D board;
+    };
+
+    const Board2D& board_at(int idx) const;
+    void apply_delta(Board2D& board, int idx) const;
+
+    Time startTime;
+    Color startColor;
+    bool active;
+    int checkpointInterval;
+    int boardCount;
+
+    std::vector<FrozenBoard2D> checkpoints;
+    std::vector<Delta> deltas;
+    std::vector<SquareChange> changes;
+
+    // least recently used cache of rebuilt boards, MATERIALIZED_BOARDS of
+    // them once allocated
+    mutable std::unique_ptr<Materialized[]> materialized;
+    mutable uint64_t useClock = 0;
+};
+
+inline Time CompressedTimeline::start_time() const {
+    return startTime;
+}
+
+inline Color CompressedTimeline::start_color() const {
+    return startColor;
+}
+
+inline bool CompressedTimeline::is_active() const {
+    return active;
+}
+
+inline int CompressedTimeline::board_count() const {
+    return boardCount;
+}
+
+inline bool CompressedTimeline::has_board_on_turn(Time time, Color c) const {
+    int idx = 2 * (time - startTime) + (c - startColor);
+    return idx >= 0 && idx < boardCount;
+}
+
+inline const Board2D& CompressedTimeline::board_on_turn(Time time, Color c) const {
+    return board_at(2 * (time - startTime) + (c - startColor));
+}
+
+#endif
@@ -0,0 +1,97 @@
+#include <cstdlib>
+
+#if defined(__linux__)
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <malloc.h>
+#endif
+
+#include "misc.h"
+
+namespace {
+#if defined(__linux__)
+    // from linux/mempolicy.h, which needs libnuma's headers on some systems
+    constexpr int MPOL_INTERLEAVE_ = 3;
+    constexpr unsigned MPOL_MF_MOVE_ = 1 << 1;
+
+    constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    // The online NUMA nodes as a bitmask, read from a list like "0-1,3",
+    // or 0 if there is only one of them or they can't be told.
+    uint64_t numa_nodes() {
+        std::ifstream in("/sys/devices/system/node/online");
+        std::string list;
+        if (!std::getline(in, list)) {
+            return 0;
+        }
+
+        uint64_t nodes = 0;
+        std::istringstream ss(list);
+        std::string range;
+        while (std::getline(ss, range, ',')) {
+            const size_t dash = range.find('-');
+            const int first = std::atoi(range.c_str());
+            const int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+            for (int n = first; n <= last && n < 64; ++n) {
+                nodes |= uint64_t(1) << n;
+            }
+        }
+
+        return nodes & (nodes - 1) ? nodes : 0;
+    }
+#endif
+}
+
+#if defined(__linux__)
+
+void* aligned_large_pages_alloc(size_t size) {
+    // whole huge pages, so that the kernel can back all of it with them
+    size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+    void* mem;
+    if (posix_memalign(&mem, HUGE_PAGE_SIZE, size)) {
+        return nullptr;
+    }
+    madvise(mem, size, MADV_HUGEPAGE);
+
+    // Best effort: the policy applies to pages as they are first touched,
+    // and MPOL_MF_MOVE spreads any malloc has touched already.
+    static const uint64_t Nodes = numa_nodes();
+    if (Nodes) {
+        syscall(SYS_mbind, mem, size, MPOL_INTERLEAVE_, &Nodes, 8 * sizeof(Nodes) + 1, MPOL_MF_MOVE_);
+    }
+
+    return mem;
+}
+
+void aligned_large_pages_free(void* mem) {
+    std::free(mem);
+}
+
+#elif defined(_WIN32)
+
+void* aligned_large_pages_alloc(size_t size) {
+    return _aligned_malloc(size, 64);
+}
+
+void aligned_large_pages_free(void* mem) {
+    _aligned_free(mem);
+}
+
+#else
+
+void* aligned_large_pages_alloc(size_t size) {
+    void* mem;
+    return posix_memalign(&mem, 64, size) ? nullptr : mem;
+}
+
+void aligned_large_pages_free(void* mem) {
+    std::free(mem);
+}
+
+#endif
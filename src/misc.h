@@ -0,0 +1,42 @@
+// This file is similar to the corresponding file in Stockfish 11.
+
+#ifndef MISC_H_INCLUDED
+#define MISC_H_INCLUDED
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+/// aligned_large_pages_alloc() allocates memory for large tables which are
+/// accessed at random, like a transposition table, where TLB misses would
+/// otherwise dominate. On Linux the memory is 2MB aligned and advised to be
+/// backed by transparent huge pages, and on hosts with several NUMA nodes
+/// it is interleaved across them, since every thread reads all of it.
+/// Elsewhere it is cache line aligned. Returns nullptr on failure. Memory
+/// from it must be freed with aligned_large_pages_free().
+void* aligned_large_pages_alloc(size_t size);
+void aligned_large_pages_free(void* mem);
+
+/// xorshift64star Pseudo-Random Number Generator
+/// This class is based on original code written and dedicated
+/// to the public domain by Sebastiano Vigna (2014).
+/// It outputs 64-bit numbers, has a single 64-bit integer of state
+/// and a period of 2^64 - 1. It must not be seeded with 0.
+class PRNG {
+    uint64_t s;
+
+    uint64_t rand64() {
+        s ^= s >> 12, s ^= s << 25, s ^= s >> 27;
+        return s * 2685821657736338717LL;
+    }
+
+public:
+    PRNG(uint64_t seed) : s(seed) { assert(seed); }
+
+    template<typename T> T rand() { return T(rand64()); }
+
+    /// a number in [0, n). Slightly biased, which is fine for workloads.
+    int rand_below(int n) { assert(n > 0); return int(rand64() % uint64_t(n)); }
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <utility>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "perf.h"
+
+namespace Perf {
+
+namespace {
+    const char* EventNames[EVENT_NB] = {
+        "cycles", "instructions", "L1D-misses", "LLC-misses", "branch-misses"
+    };
+
+#if defined(__linux__)
+    struct EventConfig {
+        uint32_t type;
+        uint64_t config;
+    };
+
+    constexpr uint64_t cache_read_misses(uint64_t cache) {
+        return cache
+             | (uint64_t(PERF_COUNT_HW_CACHE_OP_READ) << 8)
+             | (uint64_t(PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+    }
+
+    const EventConfig Configs[EVENT_NB] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, cache_read_misses(PERF_COUNT_HW_CACHE_L1D) },
+        { PERF_TYPE_HW_CACHE, cache_read_misses(PERF_COUNT_HW_CACHE_LL) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    };
+
+    int open_event(const EventConfig& config, int groupFd) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = config.type;
+        attr.config = config.config;
+        attr.disabled = groupFd == -1; // members follow the leader
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        return syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+    }
+#endif
+}
+
+Counts& Counts::operator+=(const Counts& other) {
+    for (int e = 0; e < EVENT_NB; ++e) {
+        value[e] += other.value[e];
+        counted[e] = counted[e] || other.counted[e];
+    }
+    return *this;
+}
+
+Counters::Counters() {
+    for (int e = 0; e < EVENT_NB; ++e) {
+        fds[e] = -1;
+#if defined(__linux__)
+        fds[e] = open_event(Configs[e], leader);
+        if (fds[e] >= 0 && leader == -1) {
+            leader = fds[e];
+        }
+#endif
+    }
+}
+
+Counters::~Counters() {
+#if defined(__linux__)
+    for (int fd : fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+#endif
+}
+
+bool Counters::available() const {
+    return leader >= 0;
+}
+
+void Counters::start() {
+#if defined(__linux__)
+    if (leader >= 0) {
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+}
+
+Counts Counters::stop() {
+    Counts counts;
+#if defined(__linux__)
+    if (leader < 0) {
+        return counts;
+    }
+    ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    for (int e = 0; e < EVENT_NB; ++e) {
+        // value, time enabled, time running
+        uint64_t data[3];
+        if (fds[e] < 0 || read(fds[e], data, sizeof(data)) != sizeof(data) || !data[2]) {
+            continue;
+        }
+        // scale up if the kernel had to multiplex the counters
+        counts.value[e] = data[2] < data[1] ? uint64_t(double(data[0]) * data[1] / data[2])
+                                            : data[0];
+        counts.counted[e] = true;
+    }
+#endif
+    return counts;
+}
+
+void PhaseTable::add(const std::string& phase, const Counts& counts) {
+    for (std::pair<std::string, Counts>& p : phases) {
+        if (p.first == phase) {
+            p.second += counts;
+            return;
+        }
+    }
+    phases.emplace_back(phase, counts);
+}
+
+bool PhaseTable::empty() const {
+    return phases.empty();
+}
+
+void PhaseTable::print(std::ostream& os) const {
+    char buf[256];
+
+    std::snprintf(buf, sizeof(buf), "%-28s %14s %14s %6s", "phase",
+                  EventNames[CYCLES], EventNames[INSTRUCTIONS], "IPC");
+    os << buf;
+    for (int e = L1D_READ_MISSES; e < EVENT_NB; ++e) {
+        std::snprintf(buf, sizeof(buf), " %14s", (std::string(EventNames[e]) + "/ki").c_str());
+        os << buf;
+    }
+    os << "\n";
+
+    for (const std::pair<std::string, Counts>& p : phases) {
+        const Counts& c = p.second;
+        const double kiloInstructions = c.value[INSTRUCTIONS] / 1000.0;
+
+        std::snprintf(buf, sizeof(buf), "%-28s", p.first.c_str());
+        os << buf;
+
+        for (int e = CYCLES; e <= INSTRUCTIONS; ++e) {
+            if (c.counted[e]) {
+                std::snprintf(buf, sizeof(buf), " %14llu", (unsigned long long)c.value[e]);
+            } else {
+                std::snprintf(buf, sizeof(buf), " %14s", "-");
+            }
+            os << buf;
+        }
+
+        if (c.counted[CYCLES] && c.counted[INSTRUCTIONS] && c.value[CYCLES]) {
+            std::snprintf(buf, sizeof(buf), " %6.2f", double(c.value[INSTRUCTIONS]) / c.value[CYCLES]);
+        } else {
+            std::snprintf(buf, sizeof(buf), " %6s", "-");
+        }
+        os << buf;
+
+        // misses per thousand instructions
+        for (int e = L1D_READ_MISSES; e < EVENT_NB; ++e) {
+            if (c.counted[e] && c.counted[INSTRUCTIONS] && kiloInstructions > 0) {
+                std::snprintf(buf, sizeof(buf), " %14.3f", c.value[e] / kiloInstructions);
+            } else {
+                std::snprintf(buf, sizeof(buf), " %14s", "-");
+            }
+            os << buf;
+        }
+        os << "\n";
+    }
+}
+
+Scope::Scope(Counters* setCounters, PhaseTable& setTable, std::string setPhase)
+    : counters(setCounters), table(setTable), phase(std::move(setPhase)) {
+    if (counters) {
+        counters->start();
+    }
+}
+
+Scope::~Scope() {
+    if (counters) {
+        table.add(phase, counters->stop());
+    }
+}
+
+} // namespace Perf
@@ -0,0 +1,79 @@
+#ifndef PERF_H_INCLUDED
+#define PERF_H_INCLUDED
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Hardware performance counters through Linux's perf_event_open, so that IPC
+// and cache behaviour can be broken down by phase on hosts which can't run
+// the perf tool itself. Counting is per thread: only the thread which
+// created the Counters is measured.
+namespace Perf {
+
+enum Event {
+    CYCLES, INSTRUCTIONS, L1D_READ_MISSES, LLC_READ_MISSES, BRANCH_MISSES,
+    EVENT_NB
+};
+
+struct Counts {
+    uint64_t value[EVENT_NB] = {};
+    // false if the event couldn't be counted on this host
+    bool counted[EVENT_NB] = {};
+
+    Counts& operator+=(const Counts& other);
+};
+
+// Opening the counters fails on other platforms, on CPUs or VMs without
+// the events, and when perf_event_paranoid forbids it. Events which fail
+// are left out; available() is false if none could be opened.
+class Counters {
+public:
+    Counters();
+    ~Counters();
+    Counters(const Counters&) = delete;
+    Counters& operator=(const Counters&) = delete;
+
+    bool available() const;
+    void start();
+    Counts stop();
+
+private:
+    // -1 for events which couldn't be opened. The first open one leads the
+    // group, so that all of them count over exactly the same instructions.
+    int fds[EVENT_NB];
+    int leader = -1;
+};
+
+// Counts accumulated by phase, reported in the order the phases first
+// appeared.
+class PhaseTable {
+public:
+    void add(const std::string& phase, const Counts& counts);
+    void print(std::ostream& os) const;
+    bool empty() const;
+
+private:
+    std::vector<std::pair<std::string, Counts>> phases;
+};
+
+// Counts a phase for as long as it lives. Does nothing if counters is null,
+// so instrumentation can stay in place when counting is turned off.
+class Scope {
+public:
+    Scope(Counters* counters, PhaseTable& table, std::string phase);
+    ~Scope();
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    Counters* counters;
+    PhaseTable& table;
+    std::string phase;
+};
+
+} // namespace Perf
+
+#endif
@@ -17,7 +17,8 @@ namespace {
 
 // used for rendering boards as ASCII.
 namespace {
-    std::string row_separator(const Board2D& pos) {
+    template<typename Board>
+    std::string row_separator(const Board& pos) {
         std::ostringstream ss;
         ss << "+";
 
@@ -29,7 +30,8 @@ namespace {
     }
 }
 
-// operator<<(Board2D) gives an ASCII rep. of a single 2D board.
+// operator<<(Board2D) and operator<<(FrozenBoard2D) give an ASCII rep.
+// of a single 2D board.
 // Laying out an image of the entire position is rather complex,
 // so we do it timeline-by-timeline, taking one line of text from
 // each board at a time. Newlines are separated by LF, not CRLF.
@@ -39,7 +41,8 @@ namespace {
 //
 // Each line contains the same number of columns. Each (8x8) board contains
 // 18 lines. An initial newline is not printed, but a final one is.
-std::ostream& operator<<(std::ostream& os, const Board2D& pos) {
+template<typename Board>
+static std::ostream& render_board(std::ostream& os, const Board& pos) {
     char width = pos.board_width();
     std::string row_sep = row_separator(pos);
     std::string first_row_sep = row_sep;
@@ -61,11 +64,18 @@ std::ostream& operator<<(std::ostream& os, const Board2D& pos) {
     return os;
 }
 
+std::ostream& operator<<(std::ostream& os, const Board2D& pos) {
+    return render_board(os, pos);
+}
+
+std::ostream& operator<<(std::ostream& os, const FrozenBoard2D& pos) {
+    return render_board(os, pos);
+}
+
 // Taken from Stockfish, with modifications for boards not 8x8.
 Board2D& Board2D::set(const std::string& fenStr) {
     unsigned char token, width = 0;
-    std::memset(this, 0, sizeof(Board2D));
-    std::fill_n(&pieceList[0][0], sizeof(pieceList) / sizeof(Square2D), SQ_NONE);
+    clear();
 
     // 0. calculate board width
     // we assume here that the FEN is valid
@@ -108,6 +118,40 @@ Board2D& Board2D::set(const std::string& fenStr) {
     return *this;
 }
 
+void Board2D::clear() {
+    std::memset(this, 0, sizeof(Board2D));
+    std::fill_n(&pieceList[0][0], sizeof(pieceList) / sizeof(Square2D), SQ_NONE);
+}
+
+FrozenBoard2D::FrozenBoard2D(const Board2D& board) {
+    std::memset(this, 0, sizeof(FrozenBoard2D));
+    boardWidth = board.boardWidth;
+    sideToMove = board.sideToMove;
+
+    for (Square2D s = SQ_A1; s <= SQ_H8; ++s) {
+        Piece pc = board.board[s];
+        if (pc != NO_PIECE) {
+            byTypeBB[ALL_PIECES] |= square_bb(s);
+            byTypeBB[type_of(pc)] |= square_bb(s);
+            byColorBB[color_of(pc)] |= square_bb(s);
+        }
+    }
+}
+
+Board2D& FrozenBoard2D::thaw(Board2D& out) const {
+    out.clear();
+    out.boardWidth = boardWidth;
+    out.sideToMove = sideToMove;
+
+    for (Square2D s = SQ_A1; s <= SQ_H8; ++s) {
+        if (!empty(s)) {
+            out.put_piece(piece_on(s), s);
+        }
+    }
+
+    return out;
+}
+
 // debugging function; also from stockfish, with modifications.
 // Currently not correct FEN as we aren't keeping all information like castling
 // and EP.
@@ -142,18 +186,23 @@ std::ostream& operator<<(std::ostream& os, const Timeline& line) {
     // board_width() is also the number of ranks
     // and since we get 2 lines per rank, the width is half the height
     // of the ascii board.
-    const unsigned middle_line = (unsigned) (*line.boards[0]).board_width();
+    // the last board is never frozen, and all boards have the same width.
+    const unsigned middle_line = (unsigned) line.last_board().board_width();
     std::vector<std::string> lines;
 
     std::stringstream first_string_stream;
-    first_string_stream << *line.boards[0];
+    if (line.is_frozen(0)) {
+        first_string_stream << line.frozen_board_at(0);
+    } else {
+        first_string_stream << line.board_at(0);
+    }
 
     std::string str_line;
     // prepare the vector by filling in the indentation prefix and the first board
     while (std::getline(first_string_stream, str_line, '\n')) {
         if (line.printIndented) {
             int startingPly = 2 * (line.startTime - 1) + line.startColor;
-            int charWidthOfBoard = (*line.boards[0]).board_width() * 4 + 3;
+            int charWidthOfBoard = line.last_board().board_width() * 4 + 3;
             int spaceIndent = (charWidthOfBoard + v_sep) * startingPly;
 
             str_line = std::string(spaceIndent, ' ') + str_line;
@@ -165,11 +214,13 @@ std::ostream& operator<<(std::ostream& os, const Timeline& line) {
     }
 
     // fill in the rest of the boards
-    for (size_t boardIdx = 1; boardIdx < line.boards.size(); ++boardIdx) {
-        const Board2D& board = *line.boards[boardIdx];
-
+    for (int boardIdx = 1; boardIdx < line.boardCount; ++boardIdx) {
         std::stringstream board_string;
-        board_string << board;
+        if (line.is_frozen(boardIdx)) {
+            board_string << line.frozen_board_at(boardIdx);
+        } else {
+            board_string << line.board_at(boardIdx);
+        }
 
         // all boards output the same number of lines when printed
         for (size_t linesIdx = 0; linesIdx < lines.size(); ++linesIdx) {
@@ -195,6 +246,82 @@ Timeline::Timeline(Time setStartTime, Color setStartColor) {
     startColor = setStartColor;
 }
 
+void Timeline::reset(Time setStartTime, Color setStartColor) {
+    startTime = setStartTime;
+    startColor = setStartColor;
+    active = false;
+    history.reset();
+    tail.reset();
+    boardCount = 0;
+    playableSlot = -1;
+}
+
+Timeline Timeline::clone() const {
+    Timeline tl(startTime, startColor);
+
+    tl.active = active;
+    tl.history = history;
+    tl.tail = tail;
+    tl.boardCount = boardCount;
+    tl.playableSlot = playableSlot;
+    tl.printIndented = printIndented;
+
+    return tl;
+}
+
+void Timeline::freeze() {
+    // the pages in history are full and don't hold the last board
+    if (!history || history->full.empty()) {
+        return;
+    }
+
+    // a new block, since clones may share this one
+    std::shared_ptr<PageBlock> frozen = std::make_shared<PageBlock>();
+    frozen->frozen.reserve(history_pages());
+    frozen->frozen.assign(history->frozen.begin(), history->frozen.end());
+
+    for (const std::shared_ptr<BoardPage>& page : history->full) {
+        std::shared_ptr<FrozenBoardPage> f = std::make_shared<FrozenBoardPage>();
+
+        for (int i = 0; i < BOARDS_PER_PAGE; ++i) {
+            f->boards[i] = FrozenBoard2D(page->boards[i]);
+        }
+
+        frozen->frozen.push_back(std::move(f));
+    }
+
+    history = std::move(frozen);
+}
+
+void Timeline::retire_tail() {
+    if (!history) {
+        history = std::make_shared<PageBlock>();
+    } else if (history.use_count() > 1) {
+        // Copying the block costs a pointer per page, but only happens when
+        // a shared timeline fills a page, rather than on every clone.
+        history = std::make_shared<PageBlock>(*history);
+    } else {
+        // as in append_board: a clone which held the block until now may
+        // have been reading it on another thread.
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    history->full.push_back(std::move(tail));
+}
+
+// Replaces our tail with a private copy of the boards we use from it, and
+// claims the next slot of the copy.
+void Timeline::unshare_tail() {
+    const int slot = boardCount % BOARDS_PER_PAGE;
+    std::shared_ptr<BoardPage> copy = std::make_shared<BoardPage>();
+
+    for (int i = 0; i < slot; ++i) {
+        new (&copy->boards[i]) Board2D(tail->boards[i]);
+    }
+    copy->used = slot + 1;
+
+    tail = std::move(copy);
+}
+
 int Timeline::plyToBoardIdx(Time time, Color c) const {
     int dt = time - startTime;
     int dc = c - startColor;
@@ -221,98 +348,314 @@ void Position::set
     std::vector<std::string> negativeFENs,
     std::vector<std::string> positiveFENs
 ) {
-    negativeLines.clear();
-    positiveLines.clear();
+    lines.clear();
+    pageBytes = sparePages.size() * sizeof(BoardPage);
+    centralLine = 0;
+    minLine = 0;
+    maxLine = -1;
+    playable[WHITE].clear();
+    playable[BLACK].clear();
     activePositiveLines = 0;
     activeNegativeLines = 0;
-    timeOfPresent = 0;
 
-    for (int i = negativeFENs.size() - 1; i >= 0; --i) {
-        Board2D* board = new Board2D();
-        board->set(negativeFENs[i]);
+    Board2D board;
 
-        Timeline tl(1, board->side_to_move());
-        tl.append_board(*board);
-        tl.activate();
+    // the positive side first, so that the central line is L = 0.
+    for (std::string& fen : positiveFENs) {
+        board.set(fen);
 
-        negativeLines.push_back(tl);
+        Timeline& tl = push_line(WHITE);
+        tl.reset(1, board.side_to_move());
+        tl.append_board(board);
+        tl.activate();
+        pages_changed(0, tl.page_bytes());
     }
-    for (std::string& fen : positiveFENs) {
-        Board2D* board = new Board2D();
-        board->set(fen);
+    for (int i = negativeFENs.size() - 1; i >= 0; --i) {
+        board.set(negativeFENs[i]);
 
-        Timeline tl(1, board->side_to_move());
-        tl.append_board(*board);
+        Timeline& tl = push_line(BLACK);
+        tl.reset(1, board.side_to_move());
+        tl.append_board(board);
         tl.activate();
+        pages_changed(0, tl.page_bytes());
+    }
 
-        positiveLines.push_back(tl);
+    for (L l = minLine; l <= maxLine; ++l) {
+        add_playable(l);
     }
 
     activePositiveLines = positiveFENs.size() - 1;
     activeNegativeLines = negativeFENs.size();
-    timeOfPresent = 1;
-    sideToMove = positiveLines[0].first_board().side_to_move();
+    rebuild_present();
+    sideToMove = timeline(0).first_board().side_to_move();
 }
 
-Board2D& Position::new_timeline(L branchLine, Time branchTime) {
-    const Timeline& targetLine = timeline(branchLine);
-    const Board2D& targetBoard = targetLine.board_on_turn(branchTime, sideToMove);
-
-    Board2D* newBoard = new Board2D(targetBoard);
-    newBoard->passTurn();
-    Timeline newTimeline(branchTime + (int)sideToMove, newBoard->side_to_move());
-    newTimeline.append_board(*newBoard);
+Board2D& Position::new_timeline(L branchLine, Time branchTime, NewTimelineUndo& undo) {
+    undo.activatedLine = 0;
 
     L pos_cnt = positive_timeline_count();
     L neg_cnt = negative_timeline_count();
 
+    // before looking up the target, since this may move the timelines
+    Timeline& newTimeline = push_line(sideToMove);
+    newTimeline.reset(branchTime + (int)sideToMove, other_color(sideToMove));
+    if (!sparePages.empty()) {
+        newTimeline.tail = std::move(sparePages.back());
+        sparePages.pop_back();
+    }
+    const size_t bytesBefore = newTimeline.page_bytes();
+
+    const Timeline& targetLine = timeline(branchLine);
+    Board2D thawed;
+    const Board2D& targetBoard = targetLine.full_board_at(
+        targetLine.plyToBoardIdx(branchTime, sideToMove), thawed);
+
+    Board2D& newBoard = newTimeline.append_board(targetBoard);
+    newBoard.passTurn();
+    pages_changed(bytesBefore, newTimeline.page_bytes());
+
     if (sideToMove == WHITE) {
         if (pos_cnt == neg_cnt || pos_cnt == neg_cnt - 1) {
             // all timelines are active and the new timeline should be active
             newTimeline.activate();
             ++activePositiveLines;
-            // if the new timeline goes before the present, move the present
-            timeOfPresent = std::min(timeOfPresent, newTimeline.start_time());
         } else if (pos_cnt < neg_cnt - 1) {
             // black has inactive timelines. Specifically, we know -(pos_cnt + 2) is inactive
             // and should be activated.
             newTimeline.activate();
             ++activePositiveLines;
 
-            // negativeLines is 0-indexed
-            assert(!negativeLines[pos_cnt + 1].is_active());
-            negativeLines[pos_cnt + 1].activate();
+            assert(!mutable_timeline(-(pos_cnt + 2)).is_active());
+            mutable_timeline(-(pos_cnt + 2)).activate();
+            add_playable(-(pos_cnt + 2));
             ++activeNegativeLines;
-
-            timeOfPresent = std::min(timeOfPresent,
-                                     std::min(newTimeline.start_time(),
-                                              negativeLines[pos_cnt+1].start_time()
-                                             )
-                                    );
+            undo.activatedLine = -(pos_cnt + 2);
         } // else white has more timelines and this one should stay inactive.
-
-        positiveLines.push_back(newTimeline);
     } else { // sideToMove == BLACK
         if (neg_cnt == pos_cnt || neg_cnt == pos_cnt - 1) {
             newTimeline.activate();
             ++activeNegativeLines;
-            timeOfPresent = std::min(timeOfPresent, newTimeline.start_time());
         } else if (neg_cnt < pos_cnt - 1) {
-            // white has inactive timelines, specifically, -(neg_cnt + 2) is inactive
+            // white has inactive timelines, specifically, neg_cnt + 2 is inactive
             newTimeline.activate();
             ++activeNegativeLines;
 
-            assert(!positiveLines[neg_cnt + 2].is_active());
-            positiveLines[neg_cnt + 2].activate();
-            timeOfPresent = std::min(timeOfPresent,
-                                     std::min(newTimeline.start_time(),
-                                              positiveLines[neg_cnt+2].start_time()
-                                             )
-                                    );
+            assert(!mutable_timeline(neg_cnt + 2).is_active());
+            mutable_timeline(neg_cnt + 2).activate();
+            add_playable(neg_cnt + 2);
+            ++activePositiveLines;
+            undo.activatedLine = neg_cnt + 2;
         } // else black has more timelines than white already.
+    }
+
+    L newLine = sideToMove == WHITE ? maxLine : minLine;
+    if (timeline(newLine).is_active()) {
+        add_playable(newLine);
+    }
+    undo.newLine = newLine;
+
+    // if either timeline goes before the present, this moves the present
+    update_present(newLine);
+    if (undo.activatedLine != 0) {
+        update_present(undo.activatedLine);
+    }
+
+    return newBoard;
+}
+
+void Position::freeze() {
+    for (L l = minLine; l <= maxLine; ++l) {
+        Timeline& tl = mutable_timeline(l);
+        const size_t bytesBefore = tl.page_bytes();
+        tl.freeze();
+        pages_changed(bytesBefore, tl.page_bytes());
+    }
+}
+
+MemoryUsage Position::memory_usage() const {
+    MemoryUsage usage;
+    usage.lines = lines.capacity() * sizeof(Timeline);
+
+    for (L l = minLine; l <= maxLine; ++l) {
+        const Timeline& tl = timeline(l);
+        TimelineMemory mem;
+        mem.line = l;
+
+        if (tl.history) {
+            // every page of a shared block is shared
+            const bool sharedBlock = tl.history.use_count() > 1;
+            mem.lists = sizeof(PageBlock)
+                      + tl.history->frozen.capacity() * sizeof(tl.history->frozen[0])
+                      + tl.history->full.capacity() * sizeof(tl.history->full[0]);
+
+            for (const std::shared_ptr<const FrozenBoardPage>& page : tl.history->frozen) {
+                (sharedBlock || page.use_count() > 1 ? mem.shared : mem.frozen) += sizeof(FrozenBoardPage);
+            }
+            for (const std::shared_ptr<BoardPage>& page : tl.history->full) {
+                (sharedBlock || page.use_count() > 1 ? mem.shared : mem.full) += sizeof(BoardPage);
+            }
+        }
+        if (tl.tail) {
+            (tl.tail.use_count() > 1 ? mem.shared : mem.full) += sizeof(BoardPage);
+        }
+
+        usage.full += mem.full;
+        usage.frozen += mem.frozen;
+        usage.shared += mem.shared;
+        usage.lines += mem.lists;
+        usage.timelines.push_back(mem);
+    }
 
-        negativeLines.push_back(newTimeline);
+    usage.indexes = (playable[WHITE].capacity() + playable[BLACK].capacity()) * sizeof(L)
+                  + present.memory_usage()
+                  + sparePages.capacity() * sizeof(sparePages[0])
+                  + sparePages.size() * sizeof(BoardPage);
+    usage.highWater = pageBytesHighWater;
+
+    assert(pageBytes == usage.full + usage.frozen + usage.shared
+                      + sparePages.size() * sizeof(BoardPage));
+    return usage;
+}
+
+std::ostream& operator<<(std::ostream& os, const MemoryUsage& usage) {
+    os << "Live " << usage.live() << " bytes, high water " << usage.highWater << " bytes\n"
+       << "  boards: full " << usage.full << ", frozen " << usage.frozen
+       << ", shared " << usage.shared << "\n"
+       << "  timelines " << usage.lines << ", indexes " << usage.indexes << "\n";
+    return os;
+}
+
+void Position::undo_new_timeline(const NewTimelineUndo& undo) {
+    assert(undo.newLine == maxLine || undo.newLine == minLine);
+    Timeline& newTimeline = mutable_timeline(undo.newLine);
+
+    if (newTimeline.playableSlot >= 0) {
+        remove_playable(undo.newLine);
+    }
+    if (newTimeline.is_active()) {
+        --(undo.newLine > 0 ? activePositiveLines : activeNegativeLines);
+    }
+
+    if (undo.activatedLine != 0) {
+        Timeline& activated = mutable_timeline(undo.activatedLine);
+        if (activated.playableSlot >= 0) {
+            remove_playable(undo.activatedLine);
+        }
+        activated.active = false;
+        --(undo.activatedLine > 0 ? activePositiveLines : activeNegativeLines);
+        update_present(undo.activatedLine);
+    }
+    present.update(centralLine + undo.newLine, PresentTree::NO_TIME);
+
+    const size_t bytesBefore = newTimeline.page_bytes();
+    size_t bytesKept = 0;
+
+    // a single page nothing else shares can go to the next new_timeline
+    if (   !newTimeline.history
+        && newTimeline.tail.use_count() == 1
+        && (int)sparePages.size() < MAX_SPARE_PAGES) {
+        newTimeline.tail->used = 0;
+        sparePages.push_back(std::move(newTimeline.tail));
+        bytesKept = sizeof(BoardPage);
     }
 
-    return *newBoard;
+    // leave an empty timeline in the slot, like grow_lines does
+    newTimeline.reset(0, WHITE);
+    pages_changed(bytesBefore, bytesKept);
+    if (undo.newLine > 0) {
+        --maxLine;
+    } else {
+        ++minLine;
+    }
+}
+
+Board2D& Position::append_board(L line) {
+    Timeline& targetLine = mutable_timeline(line);
+    bool tracked = targetLine.playableSlot >= 0;
+
+    if (tracked) {
+        remove_playable(line);
+    }
+
+    const size_t bytesBefore = targetLine.page_bytes();
+    Board2D& newBoard = targetLine.append_board(targetLine.last_board());
+    newBoard.passTurn();
+    pages_changed(bytesBefore, targetLine.page_bytes());
+    update_present(line);
+
+    if (tracked) {
+        add_playable(line);
+    }
+
+    return newBoard;
+}
+
+Position Position::clone() const {
+    Position pos;
+
+    copy_state_to(pos);
+    pos.present = present;
+    pos.lines.reserve(lines.size());
+    for (const Timeline& tl : lines) {
+        pos.lines.push_back(tl.clone());
+    }
+
+    return pos;
+}
+
+void Position::copy_state_to(Position& pos) const {
+    pos.centralLine = centralLine;
+    pos.minLine = minLine;
+    pos.maxLine = maxLine;
+
+    pos.playable[WHITE] = playable[WHITE];
+    pos.playable[BLACK] = playable[BLACK];
+
+    pos.activePositiveLines = activePositiveLines;
+    pos.activeNegativeLines = activeNegativeLines;
+    pos.sideToMove = sideToMove;
+
+    // the spare pages stay here
+    pos.pageBytes = pageBytes - sparePages.size() * sizeof(BoardPage);
+    pos.pageBytesHighWater = pos.pageBytes;
+}
+
+// Doubles the room for timelines, keeping the existing ones in the middle
+// so that both sides get the same amount of new space.
+void Position::grow_lines() {
+    const int used = maxLine - minLine + 1;
+    const int newSize = std::max(8, 2 * (int)lines.size());
+    const int newFirst = (newSize - used) / 2;
+
+    std::vector<Timeline> grown;
+    grown.reserve(newSize);
+
+    for (int i = 0; i < newFirst; ++i) {
+        grown.emplace_back(0, WHITE);
+    }
+    for (L l = minLine; l <= maxLine; ++l) {
+        grown.push_back(std::move(lines[centralLine + l]));
+    }
+    while ((int)grown.size() < newSize) {
+        grown.emplace_back(0, WHITE);
+    }
+
+    lines.swap(grown);
+    centralLine = newFirst - minLine;
+    rebuild_present();
+}
+
+void Position::rebuild_present() {
+    present.reset(lines.size());
+    for (L l = minLine; l <= maxLine; ++l) {
+        update_present(l);
+    }
+}
+
+constexpr int Position::MAX_SPARE_PAGES;
+constexpr Time PresentTree::NO_TIME;
+
+void PresentTree::reset(int slots) {
+    for (leaves = 1; leaves < slots; leaves *= 2) {}
+    tree.assign(2 * leaves, NO_TIME);
 }
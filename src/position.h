@@ -1,9 +1,15 @@
 #ifndef POSITION_H_INCLUDED
 #define POSITION_H_INCLUDED
 
+#include <atomic>
 #include <vector>
-#include <deque>
 #include <memory> // shared ptrs
+#include <new>    // placement new
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+#include <cassert>
 
 #include "types.h"
 
@@ -39,7 +45,11 @@ public:
     void remove_piece(Square2D s);
 
     friend class Position;
+    friend class CompressedTimeline;
+    friend class FrozenBoard2D;
 private:
+    // an empty board, without even a width
+    void clear();
     void passTurn();
     // Data members
 
@@ -66,70 +76,265 @@ private:
 
 extern std::ostream& operator<<(std::ostream& os, const Board2D& pos);
 
+// Boards in the past of a timeline are only ever read, so they don't need
+// piece lists or index[] for fast updates. A frozen board keeps only
+// bitboards, which makes it a small fraction of the size of a Board2D.
+class FrozenBoard2D {
+public:
+    FrozenBoard2D() = default;
+    explicit FrozenBoard2D(const Board2D& board);
+
+    char board_width() const;
+    Piece piece_on(Square2D s) const;
+    bool empty(Square2D s) const;
+    Color side_to_move() const;
+    Bitboard pieces(Color c) const;
+    Bitboard pieces(Color c, PieceType pt) const;
+
+    /// Rebuilds the full board into out, and returns it.
+    Board2D& thaw(Board2D& out) const;
+
+private:
+    // like Stockfish, byTypeBB[ALL_PIECES] holds every occupied square.
+    Bitboard byTypeBB[PIECE_TYPE_NB];
+    Bitboard byColorBB[COLOR_NB];
+    char boardWidth;
+    Color sideToMove;
+};
+
+extern std::ostream& operator<<(std::ostream& os, const FrozenBoard2D& pos);
+
 typedef int Time;
 typedef int L;
 
+// Timelines store their boards in fixed size pages rather than allocating
+// each board separately. Walking a timeline's history is then (mostly)
+// sequential memory access, and since a page never moves once allocated,
+// references to boards stay valid while more boards are appended.
+//
+// Boards are never modified once the move that created them is complete,
+// so cloned timelines share their pages, including the partially filled
+// last one. 'used' counts the slots of a page that have been handed out.
+// A timeline only appends into a page by claiming the next slot; if a
+// clone got there first, it copies its own boards to a fresh page instead.
+constexpr int BOARDS_PER_PAGE = 8;
+
+struct BoardPage {
+    // user-provided so that make_shared doesn't zero the boards first
+    BoardPage() {}
+
+    Board2D boards[BOARDS_PER_PAGE];
+    std::atomic<int> used{0};
+};
+
+struct FrozenBoardPage {
+    FrozenBoard2D boards[BOARDS_PER_PAGE];
+};
+
+// The full pages of a timeline: the first frozen.size() pages in frozen
+// form, then the rest in full form. A block is shared by every clone of the
+// timeline and only modified while nothing else holds it, so cloning a
+// timeline copies one pointer to it however long the timeline is.
+struct PageBlock {
+    std::vector<std::shared_ptr<const FrozenBoardPage>> frozen;
+    std::vector<std::shared_ptr<BoardPage>> full;
+};
+
 class Timeline {
 public:
     Timeline(Time startTime, Color startColor);
-    Timeline(const Timeline&) = default;
+    Timeline(const Timeline&) = delete;
+    Timeline(Timeline&&) = default;
     Timeline& operator=(const Timeline&) = delete;
+    Timeline& operator=(Timeline&&) = default;
+
+    /// A timeline with the same boards, sharing their storage with this one,
+    /// in O(1). Either can be appended to afterwards without affecting the
+    /// other.
+    Timeline clone() const;
 
     Time start_time() const;
     Color start_color() const;
+    // T coordinate of the last board
+    Time end_time() const;
     bool is_active() const;
     void activate();
 
-    // quick access
+    // quick access. first_board throws std::logic_error if the first board
+    // is frozen; the last one never is.
     const Board2D& first_board() const;
     const Board2D& last_board() const;
-    // fine access
+    // fine access. Boards in full form and frozen boards are accessed
+    // separately; board_on_turn throws std::logic_error for a frozen board.
+    // Boards are read-only once appended, since clones and snapshots may
+    // share them; only append_board and Position::new_timeline hand out a
+    // board to modify.
     bool has_board_on_turn(Time time, Color c) const;
-    Board2D& board_on_turn(Time time, Color c) const;
+    bool is_frozen_on_turn(Time time, Color c) const;
+    const Board2D& board_on_turn(Time time, Color c) const;
+    const FrozenBoard2D& frozen_board_on_turn(Time time, Color c) const;
 
-    void append_board(Board2D& newBoard);
+    /// Converts every full page of boards before the page holding the last
+    /// board into frozen form. Clones sharing those pages aren't affected.
+    void freeze();
+
+    /// Copies newBoard onto the end of the timeline and returns the copy.
+    Board2D& append_board(const Board2D& newBoard);
 
     Timeline& set_print_indented(bool pi);
 
     friend std::ostream& operator<<(std::ostream& os, const Timeline& line);
+    friend class Position;
+    friend class CompressedTimeline;
+    friend class Snapshot;
 private:
     /// returns -1 if this timeline starts after the given ply.
     int plyToBoardIdx(Time time, Color c) const;
+    bool is_frozen(int idx) const;
+    const Board2D& board_at(int idx) const;
+    const FrozenBoard2D& frozen_board_at(int idx) const;
+    // board idx in full form, thawing it into scratch if it is frozen.
+    const Board2D& full_board_at(int idx, Board2D& scratch) const;
+    // number of pages in history
+    int history_pages() const;
+    // bytes of the pages this timeline holds, shared or not
+    size_t page_bytes() const;
+    // Moves the full tail page into history.
+    void retire_tail();
+    void unshare_tail();
+    // Empties the timeline.
+    void reset(Time startTime, Color startColor);
 
     Time startTime;
     Color startColor;
 
     bool active = false;
 
-    // Stockfish's search model acts over one position, doing and un-doing moves
-    // and storing the results in a hash table. If we were to follow that model,
-    // then Board2Ds would never be duplicated and we should drop the shared_ptr.
-    std::vector<std::shared_ptr<Board2D>> boards;
+    // Board i lives in page i / BOARDS_PER_PAGE. The first history_pages()
+    // pages are full and in history, which is null while there are none.
+    // tail holds the boards after those: up to a full page of them (as far
+    // as we're concerned; see BoardPage), or none, if it was put there for
+    // append_board to fill. It is only retired into history when the next
+    // board needs a page, so the last board is always in tail.
+    std::shared_ptr<PageBlock> history;
+    std::shared_ptr<BoardPage> tail;
+    int boardCount = 0;
+
+    // index of this timeline in its Position's playable list for the side to
+    // move on last_board(), or -1 if it isn't in one.
+    int playableSlot = -1;
 
     // used for output
     bool printIndented = true;
 };
 
 
+/// What Position::new_timeline changed besides adding the timeline,
+/// so that undo_new_timeline can put it back.
+struct NewTimelineUndo {
+    L newLine;
+    // an older timeline which the new one activated, or 0 if none
+    // (the central timeline is always active).
+    L activatedLine;
+};
+
+// A segment tree with one leaf per slot of Position::lines, holding the end
+// time of the timeline in that slot if it is active (NO_TIME otherwise).
+// The present is the earliest of these, so it is always at the root and
+// updating it as timelines advance, branch or are undone costs O(log n).
+class PresentTree {
+public:
+    static constexpr Time NO_TIME = std::numeric_limits<Time>::max();
+
+    // all slots empty
+    void reset(int slots);
+    void update(int slot, Time endTime);
+    Time min() const;
+    // bytes held by the tree
+    size_t memory_usage() const;
+
+private:
+    int leaves = 0;
+    // node i has children 2i and 2i+1; leaves start at index 'leaves'.
+    std::vector<Time> tree;
+};
+
+// Bytes held by a Position, as reported by Position::memory_usage().
+// Pages of boards count in full, whether or not all of their slots are used.
+struct TimelineMemory {
+    L line;
+    // pages of boards only this position uses, by form
+    size_t full = 0;
+    size_t frozen = 0;
+    // pages of either form shared with clones or snapshots; these bytes are
+    // counted by each of the positions sharing them.
+    size_t shared = 0;
+    // the page lists
+    size_t lists = 0;
+
+    size_t total() const { return full + frozen + shared + lists; }
+};
+
+struct MemoryUsage {
+    // the existing timelines, from the lowest L up
+    std::vector<TimelineMemory> timelines;
+
+    // the sums over timelines
+    size_t full = 0;
+    size_t frozen = 0;
+    size_t shared = 0;
+    // the page lists, the Timelines themselves and the empty slots around
+    // them
+    size_t lines = 0;
+    // playable lists, the present tree and spare pages
+    size_t indexes = 0;
+
+    // The most bytes of board pages (full, frozen, shared and spare) the
+    // position has held at once. The functions which take or drop pages keep
+    // a running count, so even a peak which is undone straight away is seen.
+    // The lists and indexes aren't included.
+    size_t highWater = 0;
+
+    size_t live() const { return full + frozen + shared + lines + indexes; }
+};
+
+std::ostream& operator<<(std::ostream& os, const MemoryUsage& usage);
+
 class Position {
 public:
     Position() = default;
     Position(const Position&) = delete;
     Position& operator=(const Position&) = delete;
+    Position(Position&&) = default;
+    Position& operator=(Position&&) = default;
+
+    /// An independent copy of this position, for example for another search
+    /// thread. Boards are shared rather than copied, so this costs about one
+    /// pointer copy per page of boards. Positions cloned from each other may
+    /// be used on different threads at the same time.
+    Position clone() const;
 
     /// negative FENs should be passed top-down, that is, with the maximum
     /// absolute-value timeline first.
-    /// The central timeline should be in positiveLines[0].
+    /// The central timeline should be positiveFENs[0].
     void set(std::vector<std::string> negativeFENs, std::vector<std::string> positiveFENs);
 
     L negative_timeline_count() const;
     L positive_timeline_count() const;
-    // Doesn't check if the timeline exists, which can lead to crashes!
+    bool has_timeline(L timeline) const;
+    // Only checks that the timeline exists with an assert.
     const Timeline& timeline(L timeline) const;
+    // Checks that the timeline exists, throwing std::out_of_range if not.
+    const Timeline& timeline_at(L timeline) const;
 
     Color side_to_move() const;
     Time  time_of_present() const;
 
+    /// The active timelines whose last board has side_to_move() to move,
+    /// in no particular order. Kept up to date by the functions below;
+    /// timelines modified directly (through a cast) aren't tracked.
+    const std::vector<L>& playable_timelines() const;
+
     /// Coordinates are of the board which should be copied. Time should
     /// be the in-game T coordinate, this function will identify the correct ply
     /// based on side_to_move.
@@ -138,18 +343,78 @@ public:
     /// The new board will have the appropriate side-to-move for its coordinates,
     /// but will still need to be modified to complete the move.
     Board2D& new_timeline(L branchLine, Time branchTime);
+    Board2D& new_timeline(L branchLine, Time branchTime, NewTimelineUndo& undo);
+    /// Takes back a new_timeline in O(1). Anything done to the position since
+    /// must have been taken back first.
+    void undo_new_timeline(const NewTimelineUndo& undo);
+    /// Appends a copy of the last board of the given timeline with the turn
+    /// passed, as a move which stays on its own timeline would. Like
+    /// new_timeline, the new board still needs to be modified to complete
+    /// the move.
+    Board2D& append_board(L line);
+
+    /// Hands the move to the other player once they have finished moving
+    /// on every board they intend to.
+    void pass_turn();
+
+    /// Freezes the history of every timeline (see Timeline::freeze).
+    void freeze();
+
+    /// What the position's boards, timelines and indexes take up now, by
+    /// timeline and form of board, and the most its boards have taken up.
+    /// Walks every page, so it is meant for sizing and diagnostics rather
+    /// than for calling during a search; the high water mark itself is
+    /// kept as the position changes.
+    MemoryUsage memory_usage() const;
+
+    friend class Snapshot;
 private:
+    // Copies everything except the timelines themselves and the present
+    // tree, which is indexed by slot, into pos.
+    void copy_state_to(Position& pos) const;
+    Timeline& mutable_timeline(L timeline);
+    // Makes room for a timeline after the highest (WHITE) or before the
+    // lowest (BLACK) existing one, and returns its slot, which holds an
+    // empty timeline.
+    Timeline& push_line(Color c);
+    void grow_lines();
+    void add_playable(L timeline);
+    void remove_playable(L timeline);
+    void update_present(L timeline);
+    void rebuild_present();
+    // Adds the change in a timeline's page_bytes() to pageBytes.
+    void pages_changed(size_t before, size_t after);
+
     // Not currently supporting 2 central timelines.
-    std::vector<Timeline> negativeLines;
-    // the central timeline is positiveLines[0]
-    std::vector<Timeline> positiveLines;
+    // Timeline L is lines[centralLine + L], so lookups don't need to care
+    // about the sign of L. Only lines minLine through maxLine exist; the
+    // slots outside of them hold empty timelines, which leave room to add
+    // timelines on either side without moving the others every time.
+    std::vector<Timeline> lines;
+    int centralLine = 0;
+    L minLine = 0;
+    L maxLine = -1;
+
+    // playable[c] holds the active timelines with c to move on their last board
+    std::vector<L> playable[COLOR_NB];
 
     // doesn't include 0
     short activePositiveLines;
     short activeNegativeLines;
 
-    Time timeOfPresent;
+    PresentTree present;
     Color sideToMove;
+
+    // Pages of undone timelines which nothing else shares, for new_timeline
+    // to reuse, so that branching and undoing in a search doesn't go to the
+    // allocator every time. Not copied by clone().
+    static constexpr int MAX_SPARE_PAGES = 8;
+    std::vector<std::shared_ptr<BoardPage>> sparePages;
+
+    // bytes of the pages held by the timelines and sparePages, and the most
+    // that has been; see MemoryUsage::highWater.
+    size_t pageBytes = 0;
+    size_t pageBytesHighWater = 0;
 };
 
 extern std::ostream& operator<<(std::ostream& os, const Position& pos);
@@ -196,6 +461,38 @@ inline void Board2D::remove_piece(Square2D s) {
     pieceCount[make_piece(color_of(pc), ALL_PIECES)]--;
 }
 
+inline char FrozenBoard2D::board_width() const {
+    return boardWidth;
+}
+
+inline Color FrozenBoard2D::side_to_move() const {
+    return sideToMove;
+}
+
+inline Bitboard FrozenBoard2D::pieces(Color c) const {
+    return byColorBB[c];
+}
+
+inline Bitboard FrozenBoard2D::pieces(Color c, PieceType pt) const {
+    return byColorBB[c] & byTypeBB[pt];
+}
+
+inline bool FrozenBoard2D::empty(Square2D s) const {
+    return !(byTypeBB[ALL_PIECES] & square_bb(s));
+}
+
+inline Piece FrozenBoard2D::piece_on(Square2D s) const {
+    if (empty(s)) {
+        return NO_PIECE;
+    }
+    Color c = byColorBB[WHITE] & square_bb(s) ? WHITE : BLACK;
+    PieceType pt = PAWN;
+    while (!(byTypeBB[pt] & square_bb(s))) {
+        ++pt;
+    }
+    return make_piece(c, pt);
+}
+
 inline void Board2D::passTurn() {
     sideToMove = other_color(sideToMove);
 }
@@ -208,6 +505,11 @@ inline Color Timeline::start_color() const {
     return startColor;
 }
 
+inline Time Timeline::end_time() const {
+    // the ply of board i is 2 * startTime + startColor + i
+    return (2 * startTime + startColor + boardCount - 1) / 2;
+}
+
 inline bool Timeline::is_active() const {
     return active;
 }
@@ -216,25 +518,100 @@ inline void Timeline::activate() {
     active = true;
 }
 
+inline int Timeline::history_pages() const {
+    return history ? int(history->frozen.size() + history->full.size()) : 0;
+}
+
+inline size_t Timeline::page_bytes() const {
+    return (history ? history->frozen.size() * sizeof(FrozenBoardPage)
+                    + history->full.size() * sizeof(BoardPage) : 0)
+         + (tail ? sizeof(BoardPage) : 0);
+}
+
+inline bool Timeline::is_frozen(int idx) const {
+    return history && idx / BOARDS_PER_PAGE < (int)history->frozen.size();
+}
+
+inline const Board2D& Timeline::board_at(int idx) const {
+    assert(!is_frozen(idx));
+    const int page = idx / BOARDS_PER_PAGE;
+    const BoardPage& p = page < history_pages() ? *history->full[page - history->frozen.size()]
+                                                : *tail;
+    return p.boards[idx % BOARDS_PER_PAGE];
+}
+
+inline const FrozenBoard2D& Timeline::frozen_board_at(int idx) const {
+    assert(is_frozen(idx));
+    return history->frozen[idx / BOARDS_PER_PAGE]->boards[idx % BOARDS_PER_PAGE];
+}
+
+inline const Board2D& Timeline::full_board_at(int idx, Board2D& scratch) const {
+    return is_frozen(idx) ? frozen_board_at(idx).thaw(scratch) : board_at(idx);
+}
+
 inline const Board2D& Timeline::first_board() const {
-    return *boards.front();
+    if (is_frozen(0)) {
+        throw std::logic_error("Timeline::first_board: the first board is frozen");
+    }
+    return board_at(0);
 }
 
 inline const Board2D& Timeline::last_board() const {
-    return *boards.back();
+    return tail->boards[(boardCount - 1) % BOARDS_PER_PAGE];
 }
 
 inline bool Timeline::has_board_on_turn(Time time, Color c) const {
     int idx = plyToBoardIdx(time, c);
-    return idx < 0;
+    return idx >= 0 && idx < boardCount;
+}
+
+inline bool Timeline::is_frozen_on_turn(Time time, Color c) const {
+    return is_frozen(plyToBoardIdx(time, c));
 }
 
-inline Board2D& Timeline::board_on_turn(Time time, Color c) const {
-    return *boards[plyToBoardIdx(time, c)];
+inline const Board2D& Timeline::board_on_turn(Time time, Color c) const {
+    const int idx = plyToBoardIdx(time, c);
+    if (is_frozen(idx)) {
+        throw std::logic_error("Timeline::board_on_turn: the board is frozen, "
+                               "use frozen_board_on_turn");
+    }
+    return board_at(idx);
 }
 
-inline void Timeline::append_board(Board2D& newBoard) {
-    boards.push_back(std::shared_ptr<Board2D>(&newBoard));
+inline const FrozenBoard2D& Timeline::frozen_board_on_turn(Time time, Color c) const {
+    return frozen_board_at(plyToBoardIdx(time, c));
+}
+
+inline Board2D& Timeline::append_board(const Board2D& newBoard) {
+    const int slot = boardCount % BOARDS_PER_PAGE;
+
+    if (boardCount > 0 && slot == 0) {
+        retire_tail();
+    }
+    if (!tail) {
+        tail = std::make_shared<BoardPage>();
+    }
+
+    // newBoard may be in the page unshare_tail() replaces, so keep that
+    // alive until we've copied from it.
+    std::shared_ptr<BoardPage> lastPage;
+    int expected = slot;
+    if (!tail->used.compare_exchange_strong(expected, slot + 1)) {
+        if (tail.use_count() == 1) {
+            // the clone which appended here first is gone, and nobody
+            // else can see the slots after ours, so take them back. The
+            // clone may have written them on another thread; use_count()
+            // is a relaxed load, so order our writes after its release.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            tail->used = slot + 1;
+        } else {
+            lastPage = tail;
+            unshare_tail();
+        }
+    }
+
+    ++boardCount;
+    return *new (&tail->boards[slot]) Board2D(newBoard);
 }
 
 inline Timeline& Timeline::set_print_indented(bool pi) {
@@ -243,18 +620,41 @@ inline Timeline& Timeline::set_print_indented(bool pi) {
 }
 
 inline L Position::negative_timeline_count() const {
-    return negativeLines.size();
+    return -minLine;
 }
 
 inline L Position::positive_timeline_count() const {
-    // positiveLines[0] is the central line and shouldn't be counted
-    return positiveLines.size() - 1;
+    // the central line isn't counted
+    return maxLine;
+}
+
+inline bool Position::has_timeline(L timeline) const {
+    return timeline >= minLine && timeline <= maxLine;
 }
+
 inline const Timeline& Position::timeline(L timeline) const {
-    if (timeline >= 0) {
-        return positiveLines[timeline];
+    assert(has_timeline(timeline));
+    return lines[centralLine + timeline];
+}
+
+inline const Timeline& Position::timeline_at(L timeline) const {
+    if (!has_timeline(timeline)) {
+        throw std::out_of_range("Position::timeline_at: no timeline " + std::to_string(timeline));
     }
-    return negativeLines[-timeline - 1];
+    return lines[centralLine + timeline];
+}
+
+inline Timeline& Position::mutable_timeline(L timeline) {
+    assert(has_timeline(timeline));
+    return lines[centralLine + timeline];
+}
+
+inline Timeline& Position::push_line(Color c) {
+    if (c == WHITE ? centralLine + maxLine + 1 == (int)lines.size()
+                   : centralLine + minLine == 0) {
+        grow_lines();
+    }
+    return lines[centralLine + (c == WHITE ? ++maxLine : --minLine)];
 }
 
 inline Color Position::side_to_move() const {
@@ -262,7 +662,68 @@ inline Color Position::side_to_move() const {
 }
 
 inline Time Position::time_of_present() const {
-    return timeOfPresent;
+    return present.min();
+}
+
+inline const std::vector<L>& Position::playable_timelines() const {
+    return playable[sideToMove];
+}
+
+inline void Position::add_playable(L timeline) {
+    Timeline& tl = mutable_timeline(timeline);
+    std::vector<L>& list = playable[tl.last_board().side_to_move()];
+
+    assert(tl.is_active() && tl.playableSlot == -1);
+    tl.playableSlot = list.size();
+    list.push_back(timeline);
+}
+
+inline void Position::remove_playable(L timeline) {
+    Timeline& tl = mutable_timeline(timeline);
+    std::vector<L>& list = playable[tl.last_board().side_to_move()];
+
+    assert(tl.playableSlot >= 0 && list[tl.playableSlot] == timeline);
+    // move the last entry into the hole
+    list[tl.playableSlot] = list.back();
+    mutable_timeline(list.back()).playableSlot = tl.playableSlot;
+    list.pop_back();
+    tl.playableSlot = -1;
+}
+
+inline Board2D& Position::new_timeline(L branchLine, Time branchTime) {
+    NewTimelineUndo undo;
+    return new_timeline(branchLine, branchTime, undo);
+}
+
+inline void Position::update_present(L timeline) {
+    const Timeline& tl = this->timeline(timeline);
+    present.update(centralLine + timeline,
+                   tl.is_active() ? tl.end_time() : PresentTree::NO_TIME);
+}
+
+inline void Position::pages_changed(size_t before, size_t after) {
+    pageBytes = pageBytes - before + after;
+    pageBytesHighWater = std::max(pageBytesHighWater, pageBytes);
+}
+
+inline void PresentTree::update(int slot, Time endTime) {
+    int node = leaves + slot;
+    tree[node] = endTime;
+    for (node /= 2; node >= 1; node /= 2) {
+        tree[node] = std::min(tree[2 * node], tree[2 * node + 1]);
+    }
+}
+
+inline size_t PresentTree::memory_usage() const {
+    return tree.capacity() * sizeof(Time);
+}
+
+inline Time PresentTree::min() const {
+    return tree[1];
+}
+
+inline void Position::pass_turn() {
+    sideToMove = other_color(sideToMove);
 }
 
 #endif
@@ -0,0 +1,209 @@
+#include <string>
+#include <vector>
+#include <cassert>
+
+#include "misc.h"
+#include "position.h"
+#include "randompos.h"
+#include "trace.h"
+#include "types.h"
+
+namespace {
+    constexpr PieceType NonKings[] = { PAWN, KNIGHT, BISHOP, ROOK, QUEEN };
+
+    bool pawn_can_stand_on(Square2D s, int width) {
+        return rank_of(s) > RANK_1 && rank_of(s) < Rank(RANK_1 + width - 1);
+    }
+
+    Square2D random_square(PRNG& rng, int width) {
+        return make_square2d(File(rng.rand_below(width)), Rank(rng.rand_below(width)));
+    }
+
+    // A square which pc could move to on board: either empty or holding an
+    // enemy piece other than the king. SQ_NONE if we couldn't find one.
+    // Board is either a Board2D or a FrozenBoard2D.
+    template<typename Board>
+    Square2D random_destination(PRNG& rng, const Board& board, Piece pc) {
+        int width = board.board_width();
+
+        for (int tries = 0; tries < 16; ++tries) {
+            Square2D s = random_square(rng, width);
+            Piece target = board.piece_on(s);
+
+            if (type_of(pc) == PAWN && !pawn_can_stand_on(s, width)) {
+                continue;
+            }
+            if (target == NO_PIECE
+                || (color_of(target) != color_of(pc) && type_of(target) != KING)) {
+                return s;
+            }
+        }
+
+        return SQ_NONE;
+    }
+
+    // The square of a random piece of color c. SQ_NONE if there isn't one.
+    Square2D random_piece(PRNG& rng, const Board2D& board, Color c, bool allowKing) {
+        Square2D candidates[SQUARE_NB];
+        int count = 0;
+        int width = board.board_width();
+
+        for (Rank r = RANK_1; r < RANK_1 + width; ++r) {
+            for (File f = FILE_A; f < FILE_A + width; ++f) {
+                Square2D s = make_square2d(f, r);
+                Piece pc = board.piece_on(s);
+
+                if (pc != NO_PIECE && color_of(pc) == c
+                    && (allowKing || type_of(pc) != KING)) {
+                    candidates[count++] = s;
+                }
+            }
+        }
+
+        return count ? candidates[rng.rand_below(count)] : SQ_NONE;
+    }
+
+    std::string random_fen(PRNG& rng, const RandomPositionParams& params) {
+        int width = params.boardWidth;
+        std::string emptyFen;
+        for (int r = 0; r < width; ++r) {
+            emptyFen += char('0' + width);
+            emptyFen += r < width - 1 ? '/' : ' ';
+        }
+
+        Board2D board;
+        board.set(emptyFen + "w");
+
+        board.put_piece(W_KING, random_square(rng, width));
+        Square2D blackKing;
+        do {
+            blackKing = random_square(rng, width);
+        } while (!board.empty(blackKing));
+        board.put_piece(B_KING, blackKing);
+
+        for (Rank r = RANK_1; r < RANK_1 + width; ++r) {
+            for (File f = FILE_A; f < FILE_A + width; ++f) {
+                Square2D s = make_square2d(f, r);
+                if (!board.empty(s) || rng.rand_below(100) >= params.density) {
+                    continue;
+                }
+
+                PieceType pt = NonKings[rng.rand_below(5)];
+                if (pt == PAWN && !pawn_can_stand_on(s, width)) {
+                    pt = NonKings[1 + rng.rand_below(4)];
+                }
+                board.put_piece(make_piece(Color(rng.rand_below(2)), pt), s);
+            }
+        }
+
+        return board.fen();
+    }
+
+    void move_piece(Board2D& board, Square2D from, Square2D to) {
+        Piece pc = board.piece_on(from);
+        if (!board.empty(to)) {
+            board.remove_piece(to);
+        }
+        board.remove_piece(from);
+        board.put_piece(pc, to);
+    }
+
+    // Makes a random move which stays on the given timeline.
+    void play_move(PRNG& rng, Position& pos, L line, Color us) {
+        Board2D& board = pos.append_board(line);
+
+        for (int tries = 0; tries < 16; ++tries) {
+            Square2D from = random_piece(rng, board, us, true);
+            Square2D to = random_destination(rng, board, board.piece_on(from));
+
+            if (to != SQ_NONE) {
+                move_piece(board, from, to);
+                return;
+            }
+        }
+        // Crowded enough that we found nothing; the board is left as it was.
+    }
+
+    // Sends a random piece from the last board of the given timeline to a
+    // board in the past, creating a new timeline. Returns false if no such
+    // move was found, in which case the position is unchanged.
+    bool play_jump(PRNG& rng, Position& pos, L line, Color us) {
+        const Board2D& source = pos.timeline(line).last_board();
+        Square2D from = random_piece(rng, source, us, false);
+        if (from == SQ_NONE) {
+            return false;
+        }
+        Piece pc = source.piece_on(from);
+
+        L lineCount = pos.negative_timeline_count() + pos.positive_timeline_count() + 1;
+
+        for (int tries = 0; tries < 16; ++tries) {
+            L targetLine = rng.rand_below(lineCount) - pos.negative_timeline_count();
+            const Timeline& target = pos.timeline(targetLine);
+
+            // Boards we can land on are those with us to move, except the
+            // last one; moving there wouldn't branch.
+            std::vector<Time> times;
+            for (Time t = target.start_time() + (us < target.start_color());
+                 target.has_board_on_turn(t, us); ++t) {
+                if (t != target.end_time() || us != target.last_board().side_to_move()) {
+                    times.push_back(t);
+                }
+            }
+            if (times.empty()) {
+                continue;
+            }
+
+            Time targetTime = times[rng.rand_below(times.size())];
+            Square2D to = target.is_frozen_on_turn(targetTime, us)
+                        ? random_destination(rng, target.frozen_board_on_turn(targetTime, us), pc)
+                        : random_destination(rng, target.board_on_turn(targetTime, us), pc);
+            if (to == SQ_NONE) {
+                continue;
+            }
+
+            pos.append_board(line).remove_piece(from);
+
+            Board2D& arrival = pos.new_timeline(targetLine, targetTime);
+            if (!arrival.empty(to)) {
+                arrival.remove_piece(to);
+            }
+            arrival.put_piece(pc, to);
+            return true;
+        }
+
+        return false;
+    }
+}
+
+void random_position(Position& pos, const RandomPositionParams& params) {
+    TRACE_SCOPE("random_position");
+
+    assert(params.boardWidth >= 2 && params.boardWidth <= 8);
+    assert(params.timelines >= 1);
+
+    PRNG rng(params.seed);
+    pos.set({ }, { random_fen(rng, params) });
+
+    const int plies = 2 * params.turns;
+    for (int ply = 0; ply < plies; ++ply) {
+        Color us = pos.side_to_move();
+        // a copy, since moving changes the list
+        const std::vector<L> playable = pos.playable_timelines();
+
+        // spread the branching evenly over the remaining plies
+        int missing = params.timelines - (pos.negative_timeline_count()
+                                          + pos.positive_timeline_count() + 1);
+        int jumps = missing > 0 ? (missing + plies - ply - 1) / (plies - ply) : 0;
+
+        for (L line : playable) {
+            if (jumps > 0 && play_jump(rng, pos, line, us)) {
+                --jumps;
+            } else {
+                play_move(rng, pos, line, us);
+            }
+        }
+
+        pos.pass_turn();
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef RANDOMPOS_H_INCLUDED
+#define RANDOMPOS_H_INCLUDED
+
+#include <cstdint>
+
+#include "position.h"
+
+// Shape of the multiverse built by random_position.
+struct RandomPositionParams {
+    // total number of timelines, including the central one. This is only
+    // reached if enough turns are played to branch that often.
+    int timelines = 1;
+    // number of full turns (one ply for each player) of random moves
+    int turns = 10;
+    // must be between 2 and 8
+    int boardWidth = 8;
+    // percentage of the squares which are occupied on the starting board
+    int density = 25;
+    // must not be 0
+    uint64_t seed = 1070372;
+};
+
+/// Fills pos with a random multiverse by setting up one random board and
+/// playing random moves from it, branching into the past often enough to
+/// reach the requested number of timelines. The same parameters always
+/// give the same position.
+///
+/// Positions are structurally legal: timelines are created and activated
+/// by Position::new_timeline, every board has exactly one king of each
+/// color and pawns never stand on the first or last rank. Without move
+/// generation we can't check for checks, so kings may be left attacked.
+void random_position(Position& pos, const RandomPositionParams& params);
+
+#endif
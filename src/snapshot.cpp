@@ -0,0 +1,50 @@
+#include "position.h"
+#include "snapshot.h"
+
+// Whether line, which was cloned from orig, has been modified since.
+// Appending a board always changes the board count, and freezing replaces
+// the page block.
+bool Snapshot::same_timeline(const Timeline& orig, const Timeline& line) {
+    return orig.boardCount == line.boardCount
+        && orig.active == line.active
+        && orig.playableSlot == line.playableSlot
+        && orig.printIndented == line.printIndented
+        && orig.history == line.history
+        && orig.tail == line.tail;
+}
+
+Snapshot::Snapshot(const Position& pos) : Snapshot(pos, nullptr) { }
+
+Snapshot::Snapshot(const Position& pos, const Snapshot* parent) {
+    std::shared_ptr<Position> s = std::make_shared<Position>();
+    pos.copy_state_to(*s);
+    state = s;
+    present = pos.time_of_present();
+
+    lines.reserve(pos.maxLine - pos.minLine + 1);
+    for (L l = pos.minLine; l <= pos.maxLine; ++l) {
+        const Timeline& line = pos.timeline(l);
+
+        if (parent && parent->has_timeline(l) && same_timeline(parent->timeline(l), line)) {
+            lines.push_back(parent->lines[l - parent->state->minLine]);
+        } else {
+            lines.push_back(std::make_shared<const Timeline>(line.clone()));
+        }
+    }
+}
+
+Position Snapshot::position() const {
+    Position pos;
+    state->copy_state_to(pos);
+
+    // no spare room; Position grows the vector when it needs to.
+    pos.centralLine = -state->minLine;
+    pos.lines.reserve(lines.size());
+    for (const std::shared_ptr<const Timeline>& line : lines) {
+        pos.lines.push_back(line->clone());
+    }
+    // the slots moved, and the tree is indexed by slot
+    pos.rebuild_present();
+
+    return pos;
+}
@@ -0,0 +1,84 @@
+#ifndef SNAPSHOT_H_INCLUDED
+#define SNAPSHOT_H_INCLUDED
+
+#include <memory>
+#include <vector>
+#include <cassert>
+
+#include "position.h"
+#include "types.h"
+
+// An immutable Position. Applying a turn to a snapshot gives a new snapshot
+// and leaves the old one as it was, which makes it cheap to keep a whole
+// game history (for undo) or search tree (for MCTS) around: a snapshot
+// shares every timeline its turn didn't touch with its parent, and the
+// timelines it did touch still share their boards (see BoardPage). So a
+// snapshot costs a pointer per timeline plus what its turn added.
+//
+// Snapshots are never modified after construction and may be used from
+// several threads at once.
+class Snapshot {
+public:
+    explicit Snapshot(const Position& pos);
+
+    /// A mutable position to continue from. Like Position::clone, this
+    /// shares boards with the snapshot rather than copying them.
+    Position position() const;
+
+    /// Plays a turn, given as a function which makes the moves on a
+    /// Position, and returns the snapshot after it.
+    template<typename Turn> Snapshot apply(Turn&& turn) const;
+
+    L negative_timeline_count() const;
+    L positive_timeline_count() const;
+    bool has_timeline(L timeline) const;
+    const Timeline& timeline(L timeline) const;
+
+    Color side_to_move() const;
+    Time  time_of_present() const;
+
+private:
+    Snapshot(const Position& pos, const Snapshot* parent);
+    static bool same_timeline(const Timeline& orig, const Timeline& line);
+
+    // everything but the timelines and the present tree; state->lines is
+    // empty.
+    std::shared_ptr<const Position> state;
+    // so that snapshots don't keep a tree sized to the position's slots
+    Time present;
+    // timeline L is lines[L - state->minLine]
+    std::vector<std::shared_ptr<const Timeline>> lines;
+};
+
+template<typename Turn> inline Snapshot Snapshot::apply(Turn&& turn) const {
+    Position pos = position();
+    turn(pos);
+    return Snapshot(pos, this);
+}
+
+inline L Snapshot::negative_timeline_count() const {
+    return -state->minLine;
+}
+
+inline L Snapshot::positive_timeline_count() const {
+    return state->maxLine;
+}
+
+inline bool Snapshot::has_timeline(L timeline) const {
+    return timeline >= state->minLine && timeline <= state->maxLine;
+}
+
+inline const Timeline& Snapshot::timeline(L timeline) const {
+    assert(has_timeline(timeline));
+    return *lines[timeline - state->minLine];
+}
+
+inline Color Snapshot::side_to_move() const {
+    return state->sideToMove;
+}
+
+inline Time Snapshot::time_of_present() const {
+    return present;
+}
+
+#endif
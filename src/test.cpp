@@ -1,24 +1,346 @@
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "types.h"
+#include "history.h"
+#include "misc.h"
 #include "position.h"
+#include "randompos.h"
+#include "snapshot.h"
+
+namespace {
+    // FENs of every board, by timeline from the lowest L up.
+    typedef std::vector<std::vector<std::string>> Fens;
+
+    int Failures = 0;
+
+    void check(bool ok, const std::string& what) {
+        if (!ok) {
+            std::cout << "FAILED: " << what << std::endl;
+            ++Failures;
+        }
+    }
+
+    // Board i of a timeline starting on (time, c) is on this turn.
+    Time time_of(Time startTime, Color startColor, int i) {
+        return startTime + (startColor + i) / 2;
+    }
+
+    Color color_of(Color startColor, int i) {
+        return Color((startColor + i) % 2);
+    }
+
+    std::vector<std::string> timeline_fens(const Timeline& line) {
+        std::vector<std::string> fens;
+        Board2D thawed;
+
+        for (int i = 0; ; ++i) {
+            const Time t = time_of(line.start_time(), line.start_color(), i);
+            const Color c = color_of(line.start_color(), i);
+            if (!line.has_board_on_turn(t, c)) {
+                break;
+            }
+            fens.push_back(line.is_frozen_on_turn(t, c)
+                         ? line.frozen_board_on_turn(t, c).thaw(thawed).fen()
+                         : line.board_on_turn(t, c).fen());
+        }
+        return fens;
+    }
+
+    // Works for both Position and Snapshot.
+    template<typename P> Fens fens_of(const P& pos) {
+        Fens fens;
+        for (L l = -pos.negative_timeline_count(); l <= pos.positive_timeline_count(); ++l) {
+            fens.push_back(timeline_fens(pos.timeline(l)));
+        }
+        return fens;
+    }
+
+    // Reads every board of a compressed copy of line forwards, backwards and
+    // jumping about, so that boards come both from the checkpoints and from
+    // the cache.
+    void check_compressed(const Timeline& line, const std::vector<std::string>& fens,
+                          int checkpointInterval) {
+        const CompressedTimeline compressed(line, checkpointInterval);
+        const int n = compressed.board_count();
+        const std::string what = "CompressedTimeline every "
+                               + std::to_string(checkpointInterval) + " boards";
+
+        check(n == (int)fens.size(), what + ": board count");
+
+        std::vector<int> order;
+        for (int i = 0; i < n; ++i) {
+            order.push_back(i);
+        }
+        for (int i = n - 1; i >= 0; --i) {
+            order.push_back(i);
+        }
+        for (int i = 0; i < n; ++i) {
+            order.push_back((i * 7 + 3) % n);
+        }
+
+        for (int i : order) {
+            const Time t = time_of(compressed.start_time(), compressed.start_color(), i);
+            const Color c = color_of(compressed.start_color(), i);
+            check(compressed.board_on_turn(t, c).fen() == fens[i],
+                  what + ": board " + std::to_string(i));
+        }
+
+        check(timeline_fens(compressed.expand()) == fens, what + ": expand()");
+    }
+
+    // A clone shares boards with the position, which must not see the clone
+    // appended to, nor the other way round.
+    void check_clone(Position& pos, const Fens& original) {
+        Position clone = pos.clone();
+        check(fens_of(clone) == original, "clone");
+
+        for (L l : std::vector<L>(clone.playable_timelines())) {
+            clone.append_board(l);
+        }
+        check(fens_of(pos) == original, "original after appending to a clone");
+
+        const Fens cloned = fens_of(clone);
+        for (L l : std::vector<L>(pos.playable_timelines())) {
+            pos.append_board(l);
+        }
+        check(fens_of(clone) == cloned, "clone after appending to the original");
+    }
+
+    // A snapshot, and the snapshot after a turn played on a position from
+    // it, share boards with the position.
+    void check_snapshots(const Position& pos, const Fens& original) {
+        const Snapshot snapshot(pos);
+        check(fens_of(snapshot) == original, "Snapshot");
+        check(fens_of(snapshot.position()) == original, "Snapshot::position");
+        check(snapshot.time_of_present() == pos.time_of_present(), "Snapshot::time_of_present");
+
+        const Snapshot next = snapshot.apply([](Position& p) {
+            for (L l : std::vector<L>(p.playable_timelines())) {
+                p.append_board(l);
+            }
+            p.pass_turn();
+        });
+        check(fens_of(snapshot) == original, "Snapshot after apply");
+        check(fens_of(next) == fens_of(next.position()), "applied Snapshot::position");
+        check(next.time_of_present() == next.position().time_of_present(),
+              "applied Snapshot::time_of_present");
+    }
+
+    // Freezing keeps the boards, and leaves the clones which shared them in
+    // full form.
+    void check_freeze(Position& pos, const Fens& original) {
+        const Position clone = pos.clone();
+        pos.freeze();
+        check(fens_of(pos) == original, "Position::freeze");
+        check(fens_of(clone) == original, "clone after freeze");
+
+        for (L l = -pos.negative_timeline_count(); l <= pos.positive_timeline_count(); ++l) {
+            const Timeline& line = pos.timeline(l);
+            const std::vector<std::string>& fens = original[l + pos.negative_timeline_count()];
+
+            // every page but the last is frozen
+            check(line.is_frozen_on_turn(line.start_time(), line.start_color())
+                  == ((int)fens.size() > BOARDS_PER_PAGE), "Position::freeze: first page");
+            check(!clone.timeline(l).is_frozen_on_turn(line.start_time(), line.start_color()),
+                  "clone frozen by freeze");
+
+            // boards are read back from frozen pages too
+            check_compressed(line, fens, 16);
+        }
+        check(fens_of(Snapshot(pos)) == original, "Snapshot of a frozen position");
+    }
+
+    std::vector<L> sorted_playable(const Position& pos) {
+        std::vector<L> playable = pos.playable_timelines();
+        std::sort(playable.begin(), playable.end());
+        return playable;
+    }
+
+    // The present and the playable timelines are kept up to date as the
+    // position changes; they must be what a scan of every timeline finds.
+    void check_indexes(const Position& pos, const std::string& when) {
+        Time present = std::numeric_limits<Time>::max();
+        std::vector<L> playable;
+
+        for (L l = -pos.negative_timeline_count(); l <= pos.positive_timeline_count(); ++l) {
+            const Timeline& line = pos.timeline(l);
+            if (!line.is_active()) {
+                continue;
+            }
+            present = std::min(present, line.end_time());
+            if (line.last_board().side_to_move() == pos.side_to_move()) {
+                playable.push_back(l);
+            }
+        }
+
+        check(pos.time_of_present() == present, "time_of_present " + when);
+        check(sorted_playable(pos) == playable, "playable_timelines " + when);
+    }
+
+    // What undo_new_timeline must put back.
+    struct State {
+        L negativeCount, positiveCount;
+        Color sideToMove;
+        Time present;
+        std::vector<L> playable;
+        std::vector<bool> active;
+        std::vector<std::string> lastFens;
+
+        bool operator==(const State& s) const {
+            return negativeCount == s.negativeCount && positiveCount == s.positiveCount
+                && sideToMove == s.sideToMove && present == s.present
+                && playable == s.playable && active == s.active && lastFens == s.lastFens;
+        }
+    };
+
+    State state_of(const Position& pos) {
+        State state;
+        state.negativeCount = pos.negative_timeline_count();
+        state.positiveCount = pos.positive_timeline_count();
+        state.sideToMove = pos.side_to_move();
+        state.present = pos.time_of_present();
+        state.playable = sorted_playable(pos);
+
+        for (L l = -pos.negative_timeline_count(); l <= pos.positive_timeline_count(); ++l) {
+            state.active.push_back(pos.timeline(l).is_active());
+            state.lastFens.push_back(pos.timeline(l).last_board().fen());
+        }
+        return state;
+    }
+
+    // Branches at random and takes the branches back in LIFO order, as a
+    // search would, passing the turn after some of them so that both sides
+    // branch. Each undo must restore the state from before its branch.
+    void check_undo(const RandomPositionParams& params, bool frozen) {
+        Position pos;
+        random_position(pos, params);
+        if (frozen) {
+            pos.freeze();
+        }
+        const std::string kind = frozen ? " (frozen)" : "";
+
+        struct Branch {
+            NewTimelineUndo undo;
+            bool passed;
+            State before;
+        };
+        std::vector<Branch> branches;
+        PRNG rng(params.seed);
+
+        check_indexes(pos, "before branching" + kind);
+        for (int step = 0; step < 300; ++step) {
+            if (branches.empty() || (branches.size() < 40 && rng.rand_below(3))) {
+                const L line = rng.rand_below(pos.negative_timeline_count()
+                                            + pos.positive_timeline_count() + 1)
+                             - pos.negative_timeline_count();
+                const Timeline& target = pos.timeline(line);
+
+                std::vector<Time> times;
+                for (Time t = target.start_time(); t <= target.end_time(); ++t) {
+                    if (target.has_board_on_turn(t, pos.side_to_move())) {
+                        times.push_back(t);
+                    }
+                }
+                if (times.empty()) {
+                    continue;
+                }
+
+                Branch branch;
+                branch.before = state_of(pos);
+                pos.new_timeline(line, times[rng.rand_below(times.size())], branch.undo);
+                branch.passed = rng.rand_below(2);
+                if (branch.passed) {
+                    pos.pass_turn();
+                }
+                branches.push_back(branch);
+                check_indexes(pos, "after new_timeline" + kind);
+            } else {
+                const Branch& branch = branches.back();
+                if (branch.passed) {
+                    pos.pass_turn();
+                }
+                pos.undo_new_timeline(branch.undo);
+                check(state_of(pos) == branch.before, "undo_new_timeline" + kind);
+                check_indexes(pos, "after undo_new_timeline" + kind);
+                branches.pop_back();
+            }
+        }
+    }
+
+    // timeline_at is timeline() for the existing timelines, and throws for
+    // any other L.
+    void check_timeline_at(const Position& pos) {
+        const L lowest = -pos.negative_timeline_count();
+        const L highest = pos.positive_timeline_count();
+
+        for (L l = lowest; l <= highest; ++l) {
+            check(&pos.timeline_at(l) == &pos.timeline(l), "timeline_at " + std::to_string(l));
+        }
+        for (L l : { lowest - 1, highest + 1, lowest - 1000, highest + 1000 }) {
+            bool thrown = false;
+            try {
+                pos.timeline_at(l);
+            } catch (const std::out_of_range&) {
+                thrown = true;
+            }
+            check(thrown, "timeline_at " + std::to_string(l) + " didn't throw");
+        }
+    }
+
+    // Each way of storing boards differently must give back the boards it
+    // was given.
+    void check_round_trips(const RandomPositionParams& params) {
+        Position pos;
+        random_position(pos, params);
+        const Fens original = fens_of(pos);
+        check_timeline_at(pos);
+
+        for (L l = -pos.negative_timeline_count(); l <= pos.positive_timeline_count(); ++l) {
+            const std::vector<std::string>& fens = original[l + pos.negative_timeline_count()];
+            for (int interval : { 1, 3, 16 }) {
+                check_compressed(pos.timeline(l), fens, interval);
+            }
+        }
+
+        check_snapshots(pos, original);
+
+        Position clone = pos.clone();
+        check_clone(clone, original);
+
+        check_freeze(pos, original);
+    }
+}
 
 int main() {
     Position pos;
     pos.set({ }, { "3k/4/4/KN2 w" });
 
-    // the copies are necessary, otherwise we end up with
-    // 3 distinct shared_ptrs that all own the same board. This is a problem, because
-    // they don't internally know about each other, and then it will get deleted 3 times.
-    // this is one of those reasons to follow stockfish's one-position model, but
-    // that's something that can be changed later.
-    Board2D& board = pos.timeline(0).board_on_turn(1, WHITE);
-    ((Timeline&)pos.timeline(0)).append_board(*(new Board2D(board)));
-    ((Timeline&)pos.timeline(0)).append_board(*(new Board2D(board)));
+    pos.append_board(0);
+    pos.append_board(0);
 
     Board2D& new_board = pos.new_timeline(0, 1);
     new_board.remove_piece(SQ_D4);
     new_board.put_piece(B_KING, SQ_C4);
 
     std::cout << pos << std::endl;
+
+    RandomPositionParams params;
+    for (int timelines : { 1, 5, 20 }) {
+        for (int turns : { 3, 20, 45 }) {
+            params.timelines = timelines;
+            params.turns = turns;
+            params.boardWidth = 3 + (timelines + turns) % 6;
+            check_round_trips(params);
+            check_undo(params, false);
+            check_undo(params, true);
+        }
+    }
+
+    std::cout << "Checks: " << (Failures ? "FAILED" : "ok") << std::endl;
+    return Failures ? 1 : 0;
 }
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "trace.h"
+
+namespace Trace {
+
+namespace {
+    // spans per thread
+    constexpr size_t RING_SIZE = 1 << 16;
+
+    struct Event {
+        const char* name;
+        uint64_t begin, end;
+    };
+
+    // A single producer, single consumer ring: head is only written by the
+    // thread the buffer belongs to, tail only by the writer.
+    struct ThreadBuffer {
+        int tid;
+        std::atomic<const char*> name{nullptr};
+        std::vector<Event> ring = std::vector<Event>(RING_SIZE);
+        std::atomic<size_t> head{0};
+        std::atomic<size_t> tail{0};
+        std::atomic<uint64_t> dropped{0};
+        // set once the thread has exited and won't record any more
+        std::atomic<bool> dead{false};
+        // used by the writer only
+        bool nameWritten = false;
+    };
+
+    // A buffer outlives its thread until the writer has written its last
+    // spans, and is then dropped from Buffers.
+    std::mutex BuffersMutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> Buffers;
+    // tids aren't reused, so that a trace doesn't mix up two threads
+    int NextTid = 1;
+    // spans lost by the threads whose buffers have been dropped
+    uint64_t DeadDropped = 0;
+
+    // The calling thread's name and buffer. The buffer is only made by the
+    // thread's first span while a trace is running, so threads which never
+    // record one cost nothing.
+    struct LocalState {
+        const char* name = nullptr;
+        std::shared_ptr<ThreadBuffer> buffer;
+
+        ~LocalState() {
+            if (buffer) {
+                buffer->dead.store(true, std::memory_order_release);
+            }
+        }
+    };
+    thread_local LocalState Local;
+
+    ThreadBuffer& local_buffer() {
+        if (!Local.buffer) {
+            std::shared_ptr<ThreadBuffer> buf = std::make_shared<ThreadBuffer>();
+            buf->name.store(Local.name, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lock(BuffersMutex);
+            buf->tid = NextTid++;
+            Buffers.push_back(buf);
+            Local.buffer = std::move(buf);
+        }
+        return *Local.buffer;
+    }
+
+    // Drops the buffers of exited threads which have nothing left to write.
+    void drop_dead_buffers() {
+        std::lock_guard<std::mutex> lock(BuffersMutex);
+        Buffers.erase(std::remove_if(Buffers.begin(), Buffers.end(),
+            [](const std::shared_ptr<ThreadBuffer>& buf) {
+                if (   !buf->dead.load(std::memory_order_acquire)
+                    || buf->tail.load(std::memory_order_relaxed)
+                       != buf->head.load(std::memory_order_relaxed)) {
+                    return false;
+                }
+                DeadDropped += buf->dropped;
+                return true;
+            }), Buffers.end());
+    }
+
+    // serializes start() and stop()
+    std::mutex ControlMutex;
+
+    // The writer thread. While it runs, only it touches Out.
+    std::thread Writer;
+    std::mutex WriterMutex;
+    std::condition_variable WriterWake;
+    bool Stopping;
+
+    std::ofstream Out;
+    uint64_t Epoch;
+    bool FirstEvent;
+
+    constexpr auto DRAIN_INTERVAL = std::chrono::milliseconds(20);
+
+    void write_string(const char* s) {
+        Out << '"';
+        for (; *s; ++s) {
+            if (*s == '"' || *s == '\\') {
+                Out << '\\';
+            }
+            Out << *s;
+        }
+        Out << '"';
+    }
+
+    void begin_event() {
+        Out << (FirstEvent ? "\n" : ",\n");
+        FirstEvent = false;
+    }
+
+    void drain() {
+        std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+        {
+            std::lock_guard<std::mutex> lock(BuffersMutex);
+            buffers = Buffers;
+        }
+
+        bool anyDead = false;
+        for (const std::shared_ptr<ThreadBuffer>& buf : buffers) {
+            // before head, so that a dead buffer's last spans are seen
+            anyDead |= buf->dead.load(std::memory_order_acquire);
+            const size_t head = buf->head.load(std::memory_order_acquire);
+            size_t tail = buf->tail.load(std::memory_order_relaxed);
+
+            // only for threads which show up in this trace
+            const char* name = buf->name.load(std::memory_order_acquire);
+            if (name && !buf->nameWritten && tail != head) {
+                begin_event();
+                Out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buf->tid
+                    << ",\"args\":{\"name\":";
+                write_string(name);
+                Out << "}}";
+                buf->nameWritten = true;
+            }
+
+            for (; tail != head; ++tail) {
+                const Event& e = buf->ring[tail % RING_SIZE];
+                // begun before this trace started
+                if (e.begin < Epoch) {
+                    continue;
+                }
+                begin_event();
+                Out << "{\"name\":";
+                write_string(e.name);
+                Out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buf->tid
+                    << ",\"ts\":" << (e.begin - Epoch) / 1000.0
+                    << ",\"dur\":" << (e.end - e.begin) / 1000.0 << "}";
+            }
+            buf->tail.store(tail, std::memory_order_release);
+        }
+
+        if (anyDead) {
+            drop_dead_buffers();
+        }
+    }
+
+    void writer_loop() {
+        std::unique_lock<std::mutex> lock(WriterMutex);
+        while (!Stopping) {
+            WriterWake.wait_for(lock, DRAIN_INTERVAL);
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+    }
+}
+
+namespace detail {
+    std::atomic<bool> Enabled{false};
+
+    uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void record(const char* name, uint64_t begin, uint64_t end) {
+        if (!Enabled.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        ThreadBuffer& buf = local_buffer();
+        const size_t head = buf.head.load(std::memory_order_relaxed);
+        if (head - buf.tail.load(std::memory_order_acquire) == RING_SIZE) {
+            buf.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        buf.ring[head % RING_SIZE] = { name, begin, end };
+        buf.head.store(head + 1, std::memory_order_release);
+    }
+}
+
+bool start(const std::string& path) {
+    std::lock_guard<std::mutex> control(ControlMutex);
+    if (detail::Enabled) {
+        return false;
+    }
+
+    Out.open(path);
+    if (!Out) {
+        Out.clear();
+        return false;
+    }
+    // microseconds, to the nanosecond
+    Out << std::fixed << std::setprecision(3);
+    Out << "{\"traceEvents\":[";
+    FirstEvent = true;
+    Epoch = detail::now();
+
+    // forget whatever was left over from an earlier trace
+    {
+        std::lock_guard<std::mutex> lock(BuffersMutex);
+        for (const std::shared_ptr<ThreadBuffer>& buf : Buffers) {
+            buf->tail = buf->head.load();
+            buf->dropped = 0;
+            buf->nameWritten = false;
+        }
+        DeadDropped = 0;
+    }
+    drop_dead_buffers();
+
+    Stopping = false;
+    Writer = std::thread(writer_loop);
+    detail::Enabled = true;
+    return true;
+}
+
+void stop() {
+    std::lock_guard<std::mutex> control(ControlMutex);
+    if (!detail::Enabled) {
+        return;
+    }
+    detail::Enabled = false;
+
+    {
+        std::lock_guard<std::mutex> lock(WriterMutex);
+        Stopping = true;
+    }
+    WriterWake.notify_one();
+    Writer.join();
+    drain();
+
+    uint64_t dropped;
+    {
+        std::lock_guard<std::mutex> lock(BuffersMutex);
+        dropped = DeadDropped;
+        for (const std::shared_ptr<ThreadBuffer>& buf : Buffers) {
+            dropped += buf->dropped;
+        }
+    }
+
+    Out << "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"droppedSpans\":\""
+        << dropped << "\"}}\n";
+    Out.close();
+}
+
+void set_thread_name(const char* name) {
+    Local.name = name;
+    if (Local.buffer) {
+        Local.buffer->name.store(name, std::memory_order_release);
+    }
+}
+
+} // namespace Trace
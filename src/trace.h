@@ -0,0 +1,71 @@
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Spans of time in the Chrome trace event format, which chrome://tracing
+// and Perfetto can load, to see what each thread was doing when something
+// took longer than it should have.
+//
+// Each thread records its spans into a ring buffer of its own, which a
+// background thread drains to the file, so a span costs two clock reads and
+// a few stores while a trace runs, and a relaxed load otherwise. A thread
+// which fills its buffer faster than it is drained loses its newest spans;
+// the number lost is written to the trace's metadata. A thread's buffer is
+// only allocated by its first span while a trace runs, and is freed once
+// the thread has exited and its spans have been written.
+//
+//   Trace::start("bench.json");
+//   {
+//       TRACE_SCOPE("random_position");
+//       random_position(pos, params);
+//   }
+//   Trace::stop();
+namespace Trace {
+
+/// Starts writing a trace to the given file. Returns false if the file
+/// can't be opened or a trace is already running.
+bool start(const std::string& path);
+/// Writes out the remaining spans and closes the file. Spans which haven't
+/// ended yet are left out.
+void stop();
+
+/// Names the calling thread in traces. name must outlive them. This only
+/// stores the pointer, so it may be called whether or not a trace runs.
+void set_thread_name(const char* name);
+
+namespace detail {
+    extern std::atomic<bool> Enabled;
+    uint64_t now();
+    void record(const char* name, uint64_t begin, uint64_t end);
+}
+
+// A span lasting as long as the Span does. name must outlive the trace;
+// a string literal for example.
+class Span {
+public:
+    explicit Span(const char* setName)
+        : name(setName),
+          begin(detail::Enabled.load(std::memory_order_relaxed) ? detail::now() : 0) {}
+    ~Span() {
+        if (begin) {
+            detail::record(name, begin, detail::now());
+        }
+    }
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    const char* name;
+    uint64_t begin;
+};
+
+} // namespace Trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) Trace::Span TRACE_CONCAT(traceSpan, __LINE__)(name)
+
+#endif
@@ -3,9 +3,12 @@
 #ifndef TYPES_H_INCLUDED
 #define TYPES_H_INCLUDED
 
+#include <cstdint>
+
 // TODO: encoding of moves
 
 typedef int Depth;
+typedef uint64_t Bitboard;
 
 enum Color {
     WHITE, BLACK, COLOR_NB = 2
@@ -146,6 +149,10 @@ constexpr Rank rank_of(Square2D s) {
     return Rank(s >> 3);
 }
 
+constexpr Bitboard square_bb(Square2D s) {
+    return Bitboard(1) << s;
+}
+
 constexpr Direction2D pawn_push(Color c) {
     return c == WHITE ? NORTH : SOUTH;
 }